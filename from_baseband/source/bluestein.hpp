@@ -0,0 +1,44 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// host-side tables of Bluestein (chirp-z) fft, used by bluestein_premultiply() & co. in kernel.hpp:
+//     X_k = w_k * sum_j (x_j * w_j) * conj(w_(k-j)),  w_j = exp(-i pi j^2 / n)
+// the sum is a circular convolution of length `length` >= 2n - 1.
+// kept apart from the OpenCL code so that it can be checked on host.
+
+#pragma once
+#ifndef _BLUESTEIN_HPP
+#define _BLUESTEIN_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace bluestein {
+
+/**
+ * @brief interleaved complex chirp w_j, j < n, and conj(w) wrapped around to length `length`,
+ *        i.e. conj(w_j) at j and at length - j, zero elsewhere
+ */
+template <typename data_type>
+void tables(size_t n, size_t length, std::vector<data_type> &chirp, std::vector<data_type> &kernel) {
+    chirp.assign(2 * n, static_cast<data_type>(0));
+    kernel.assign(2 * length, static_cast<data_type>(0));
+    for (size_t j = 0; j < n; j++) {
+        // j^2 mod 2n keeps the phase exact for long segments
+        double phase = M_PI * static_cast<double>((static_cast<unsigned long long>(j) * j) % (2 * n)) / n;
+        chirp[2 * j] = std::cos(phase);
+        chirp[2 * j + 1] = -std::sin(phase);
+        size_t wrapped = (length - j) % length;
+        kernel[2 * j] = kernel[2 * wrapped] = std::cos(phase);
+        kernel[2 * j + 1] = kernel[2 * wrapped + 1] = std::sin(phase);
+    }
+}
+
+} // namespace bluestein
+
+#endif // _BLUESTEIN_HPP
@@ -24,4 +24,12 @@ inline bool check_fft_length(size_t l) {
     return divide_all(divide_all(divide_all(divide_all(l, static_cast<size_t>(2)), static_cast<size_t>(3)), static_cast<size_t>(5)), static_cast<size_t>(7)) == 1;
 }
 
+/** @brief smallest length not less than `l` that clFFT supports */
+inline size_t next_fft_length(size_t l) {
+    while (!check_fft_length(l)) {
+        l++;
+    }
+    return l;
+}
+
 #endif // _CHECKS_CPP
\ No newline at end of file
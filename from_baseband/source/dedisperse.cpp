@@ -0,0 +1,230 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// incoherent dedispersion of a filterbank file, many DM trials in one pass,
+// writes one sigproc time series (.tim) per DM trial.
+// the file is memory-mapped and processed in blocks, consecutive blocks overlap by the max dispersive delay,
+// so files larger than memory can be processed.
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "filterbank_file.hpp"
+#include "parallel.hpp"
+#include "sigproc.hpp"
+#include "stopwatch.h"
+#include "types.h"
+
+// dispersion delay constant, in s * MHz^2 / (pc cm^-3)
+constexpr double dispersion_constant = 4.148808e3;
+
+// size of tiles of time axis in dedispersion, output tile should stay in L1 cache
+constexpr size_t time_tile = 4096;
+// size of tiles in corner turn, in samples and channels
+constexpr size_t transpose_tile = 64;
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+
+    boost::program_options::options_description general_option("General Options"), dm_option("Dedispersion Options"), raw_option("Raw Input Options"), all_option("Options");
+    using boost::program_options::value;
+    /* clang-format off */
+    general_option.add_options()
+        ("help,h", "Show help message")
+        ("input_file,f,i", value<std::string>(), "Input filterbank file, sigproc format or raw output of filterbank-generation-test")
+        ("output_prefix,o", value<std::string>(), "Prefix of output file names, output is <prefix>_DM<dm>.tim, with as many decimals of DM as --dm_step needs (at least 2)")
+        ("threads", value<size_t>()->default_value(0), "Number of threads, 0 to use all cores")
+        ("block_nsamps", value<size_t>()->default_value(65536), "Number of output samples per block, larger blocks use more memory")
+    ;
+    dm_option.add_options()
+        ("dm_min", value<double>()->default_value(0.0), "Min DM trial")
+        ("dm_max", value<double>(), "Max DM trial")
+        ("dm_step", value<double>()->default_value(1.0), "Step between DM trials")
+    ;
+    raw_option.add_options()
+        ("nchans", value<int32_t>(), "Number of channels")
+        ("nifs", value<int32_t>()->default_value(1), "Number of IFs, only the first one is dedispersed")
+        ("nbits", value<int32_t>()->default_value(32), "Bits per sample, 1, 2, 4, 8, 16 or 32 (float)")
+        ("tsamp", value<double>(), "Sampling time, in seconds")
+        ("fch1", value<double>(), "Frequency of first channel, in MHz")
+        ("foff", value<double>(), "Channel bandwidth, in MHz")
+    ;
+    /* clang-format on */
+    all_option.add(general_option).add(dm_option).add(raw_option);
+    boost::program_options::positional_options_description p;
+    p.add("input_file", 1);
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(all_option).positional(p).run(), vm);
+    boost::program_options::notify(vm);
+
+    if (vm.count("help") || !(vm.count("input_file") && vm.count("output_prefix") && vm.count("dm_max"))) {
+        std::cout << general_option << std::endl;
+        std::cout << dm_option << std::endl;
+        std::cout << raw_option << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+
+    // ------------
+    // Read header and set up
+    // ------------
+    sigproc::header raw_header;
+    if (vm.count("nchans") && vm.count("tsamp") && vm.count("fch1") && vm.count("foff")) {
+        raw_header.nchans = vm["nchans"].as<int32_t>();
+        raw_header.nifs = vm["nifs"].as<int32_t>();
+        raw_header.nbits = vm["nbits"].as<int32_t>();
+        raw_header.tsamp = vm["tsamp"].as<double>();
+        raw_header.fch1 = vm["fch1"].as<double>();
+        raw_header.foff = vm["foff"].as<double>();
+    }
+    std::string in_file_name = vm["input_file"].as<std::string>();
+    filterbank_file in_file(in_file_name, raw_header);
+    const sigproc::header &header = in_file.header;
+    if (header.tsamp <= 0.0 || header.foff == 0.0) {
+        std::cerr << in_file_name << " has no sigproc header, raw input options are required" << std::endl;
+        return 1;
+    }
+
+    size_t nchans = header.nchans;
+    size_t thread_count = vm["threads"].as<size_t>();
+    if (thread_count == 0) {
+        thread_count = default_thread_count();
+    }
+    std::vector<double> dms;
+    double dm_min = vm["dm_min"].as<double>(), dm_max = vm["dm_max"].as<double>(), dm_step = vm["dm_step"].as<double>();
+    // negative DM would give negative delays
+    if (!(dm_step > 0.0 && dm_min >= 0.0 && dm_max >= dm_min)) {
+        std::cerr << "Invalid DM range, should be 0 <= dm_min <= dm_max and dm_step > 0" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; dm_min + i * dm_step <= dm_max + 1e-9 * dm_step; i++) {
+        dms.push_back(dm_min + i * dm_step);
+    }
+    size_t ndm = dms.size();
+
+    // delays in samples relative to the highest frequency
+    double f_ref = std::max(header.channel_frequency(0), header.channel_frequency(nchans - 1));
+    std::vector<size_t> delays(ndm * nchans);
+    size_t max_delay = 0;
+    for (size_t d = 0; d < ndm; d++) {
+        for (size_t c = 0; c < nchans; c++) {
+            double f = header.channel_frequency(c);
+            double delay = dispersion_constant * dms[d] * (1.0 / (f * f) - 1.0 / (f_ref * f_ref)) / header.tsamp;
+            delays[d * nchans + c] = static_cast<size_t>(std::round(delay));
+            max_delay = std::max(max_delay, delays[d * nchans + c]);
+        }
+    }
+
+    size_t block_nsamps = vm["block_nsamps"].as<size_t>();
+    size_t pitch = block_nsamps + max_delay; // row pitch of channel-major buffer
+    std::vector<data_type> h_time_major(pitch * nchans), h_chan_major(pitch * nchans);
+    std::vector<data_type> h_out(ndm * block_nsamps);
+
+    std::string output_prefix = vm["output_prefix"].as<std::string>();
+    std::vector<std::unique_ptr<std::ofstream>> out_streams;
+    // one more digit than dm_step needs, so that neighbouring trials don't get the same name
+    int dm_precision = std::max(2, static_cast<int>(std::ceil(-std::log10(dm_step))) + 1);
+    for (size_t d = 0; d < ndm; d++) {
+        std::ostringstream out_file_name;
+        out_file_name << output_prefix << "_DM" << std::fixed << std::setprecision(dm_precision) << dms[d] << ".tim";
+        out_streams.emplace_back(new std::ofstream(out_file_name.str(), std::ios::binary));
+        sigproc::header out_header = header;
+        out_header.data_type = 2;
+        out_header.nchans = 1;
+        out_header.nifs = 1;
+        out_header.nbits = 32;
+        out_header.fch1 = f_ref;
+        out_header.refdm = dms[d];
+        sigproc::write_header(*out_streams[d], out_header);
+    }
+
+    std::cout << "nchans = " << nchans << ", " << "tsamp = " << header.tsamp << ", " << "fch1 = " << header.fch1 << ", " << "foff = " << header.foff << std::endl
+              << "ndm = " << ndm << ", " << "max_delay = " << max_delay << " samples" << std::endl
+              << "threads = " << thread_count << std::endl;
+
+    // ------------
+    // Dedisperse block by block
+    // ------------
+    Stopwatch read_timer, transpose_timer, dedisperse_timer, write_timer;
+    size_t total_out = 0;
+    for (block_view view : in_file.blocks(pitch, block_nsamps)) {
+        size_t count = view.nsamps;
+        if (count <= max_delay) {
+            break;
+        }
+
+        read_timer.start();
+        size_t time_chunks = (count + transpose_tile - 1) / transpose_tile;
+        parallel_for(time_chunks, thread_count, [&](size_t chunk) {
+            for (size_t t = chunk * transpose_tile; t < std::min((chunk + 1) * transpose_tile, count); t++) {
+                view.unpack(t, h_time_major.data() + t * nchans);
+            }
+        });
+        read_timer.stop();
+
+        // corner turn to channel-major, in tiles
+        transpose_timer.start();
+        size_t chan_tiles = (nchans + transpose_tile - 1) / transpose_tile;
+        parallel_for(chan_tiles, thread_count, [&](size_t tile) {
+            size_t c_begin = tile * transpose_tile, c_end = std::min(c_begin + transpose_tile, nchans);
+            for (size_t t_begin = 0; t_begin < count; t_begin += transpose_tile) {
+                size_t t_end = std::min(t_begin + transpose_tile, count);
+                for (size_t c = c_begin; c < c_end; c++) {
+                    data_type *row = h_chan_major.data() + c * pitch;
+                    for (size_t t = t_begin; t < t_end; t++) {
+                        row[t] = h_time_major[t * nchans + c];
+                    }
+                }
+            }
+        });
+        transpose_timer.stop();
+
+        // shift-and-sum, work items are (DM trial, time tile)
+        dedisperse_timer.start();
+        size_t out_count = std::min(count - max_delay, block_nsamps);
+        size_t time_tiles = (out_count + time_tile - 1) / time_tile;
+        parallel_for(ndm * time_tiles, thread_count, [&](size_t item) {
+            size_t d = item / time_tiles, t_begin = (item % time_tiles) * time_tile;
+            size_t length = std::min(time_tile, out_count - t_begin);
+            data_type *out = h_out.data() + d * block_nsamps + t_begin;
+            const size_t *delay = delays.data() + d * nchans;
+            std::fill(out, out + length, static_cast<data_type>(0));
+            for (size_t c = 0; c < nchans; c++) {
+                const data_type *in = h_chan_major.data() + c * pitch + delay[c] + t_begin;
+                for (size_t t = 0; t < length; t++) {
+                    out[t] += in[t];
+                }
+            }
+        });
+        dedisperse_timer.stop();
+
+        write_timer.start();
+        for (size_t d = 0; d < ndm; d++) {
+            out_streams[d]->write(reinterpret_cast<const char *>(h_out.data() + d * block_nsamps), out_count * sizeof(data_type));
+        }
+        write_timer.stop();
+        total_out += out_count;
+
+        std::cout << "samples written: " << total_out << "  "
+                  << "read_timer: " << read_timer.getTime() << "  "
+                  << "transpose_timer: " << transpose_timer.getTime() << "  "
+                  << "dedisperse_timer: " << dedisperse_timer.getTime() << "  "
+                  << "write_timer: " << write_timer.getTime() << "    \r";
+        std::cout.flush();
+    }
+    std::cout << std::endl
+              << "total samples per DM trial: " << total_out << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,401 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// chunked, compressed filterbank container (.fbz).
+// data is cut into chunks of fixed count of time samples, each chunk is bit-shuffled then compressed by zstd,
+// chunks are compressed by worker threads in parallel and written in order, an index at end of file
+// allows random access by time. layout, all integers little endian:
+//     header:  "FBZ1", u32 version, u32 element_size, u32 codec, u64 sample_bytes, u64 chunk_nsamps,
+//              u64 sigproc_header_size, then the sigproc header of original file (may be empty)
+//     chunks:  compressed data
+//     index:   u64 chunk_count, then (u64 offset, u64 compressed_size, u64 nsamps) of each chunk
+//     footer:  u64 index_offset, "FBZI"
+// the same layout is written by the udp receiver, see udp_receiver/rust/src/fbz.rs
+
+#pragma once
+#ifndef _FBZ_HPP
+#define _FBZ_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zstd.h>
+
+namespace fbz {
+
+constexpr char magic[4] = {'F', 'B', 'Z', '1'};
+constexpr char index_magic[4] = {'F', 'B', 'Z', 'I'};
+constexpr uint32_t version = 1;
+constexpr uint32_t codec_zstd = 1;
+
+/** @brief transpose 8x8 bit matrix in `x`, byte i bit j <-> byte j bit i; it is its own inverse (Hacker's Delight 7-3) */
+inline uint64_t transpose_8x8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+/**
+ * @brief bit-shuffle `count` elements of `element_size` bytes: output is `8 * element_size` bit planes of `count / 8` bytes,
+ *        so slowly varying bits of neighbouring values become long runs. elements that don't fill a group of 8 are copied as is.
+ */
+inline void bitshuffle(const uint8_t *in, uint8_t *out, size_t count, size_t element_size) {
+    size_t groups = count / 8;
+    for (size_t g = 0; g < groups; g++) {
+        for (size_t b = 0; b < element_size; b++) {
+            uint64_t x = 0;
+            for (size_t i = 0; i < 8; i++) {
+                x |= static_cast<uint64_t>(in[(8 * g + i) * element_size + b]) << (8 * i);
+            }
+            x = transpose_8x8(x);
+            for (size_t k = 0; k < 8; k++) {
+                out[(8 * b + k) * groups + g] = static_cast<uint8_t>(x >> (8 * k));
+            }
+        }
+    }
+    if (count > 8 * groups) {
+        std::memcpy(out + 8 * groups * element_size, in + 8 * groups * element_size, (count - 8 * groups) * element_size);
+    }
+}
+
+/** @brief inverse of bitshuffle() */
+inline void bitunshuffle(const uint8_t *in, uint8_t *out, size_t count, size_t element_size) {
+    size_t groups = count / 8;
+    for (size_t g = 0; g < groups; g++) {
+        for (size_t b = 0; b < element_size; b++) {
+            uint64_t x = 0;
+            for (size_t k = 0; k < 8; k++) {
+                x |= static_cast<uint64_t>(in[(8 * b + k) * groups + g]) << (8 * k);
+            }
+            x = transpose_8x8(x);
+            for (size_t i = 0; i < 8; i++) {
+                out[(8 * g + i) * element_size + b] = static_cast<uint8_t>(x >> (8 * i));
+            }
+        }
+    }
+    if (count > 8 * groups) {
+        std::memcpy(out + 8 * groups * element_size, in + 8 * groups * element_size, (count - 8 * groups) * element_size);
+    }
+}
+
+struct chunk_info {
+    uint64_t offset, compressed_size, nsamps;
+};
+
+namespace detail {
+
+template <typename T>
+inline void write_value(std::ostream &stream, const T &value) {
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+inline T read_value(std::istream &stream) {
+    T value;
+    stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+    return value;
+}
+
+} // namespace detail
+
+/**
+ * @brief appends samples, compresses full chunks on `thread_count` worker threads and writes them in order.
+ *        at most 2 * thread_count chunks are in flight, so memory is bounded.
+ *        errors of worker threads are thrown by the next write() or close().
+ */
+class writer {
+public:
+    writer(const std::string &file_name, const std::string &sigproc_header, size_t element_size_, size_t sample_bytes_, size_t chunk_nsamps_, size_t thread_count, int level_ = 1)
+        : stream(file_name, std::ios::binary), element_size(element_size_), sample_bytes(sample_bytes_), chunk_nsamps(chunk_nsamps_), level(level_),
+          max_in_flight(2 * std::max(thread_count, static_cast<size_t>(1))) {
+        using detail::write_value;
+        if (!stream) {
+            throw std::runtime_error("Cannot open " + file_name);
+        }
+        if (sample_bytes % element_size != 0 || chunk_nsamps == 0) {
+            throw std::runtime_error("fbz: invalid chunk shape");
+        }
+        stream.write(magic, sizeof(magic));
+        write_value(stream, version);
+        write_value(stream, static_cast<uint32_t>(element_size));
+        write_value(stream, codec_zstd);
+        write_value(stream, static_cast<uint64_t>(sample_bytes));
+        write_value(stream, static_cast<uint64_t>(chunk_nsamps));
+        write_value(stream, static_cast<uint64_t>(sigproc_header.size()));
+        stream.write(sigproc_header.data(), sigproc_header.size());
+        for (size_t i = 0; i < std::max(thread_count, static_cast<size_t>(1)); i++) {
+            workers.emplace_back([this]() { work(); });
+        }
+        output_thread = std::thread([this]() { output(); });
+    }
+
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+
+    ~writer() {
+        try {
+            close();
+        } catch (...) {
+            // call close() to see errors
+        }
+    }
+
+    /** @brief append `nsamps` samples of `sample_bytes` each */
+    void write(const void *data, size_t nsamps) {
+        check_error();
+        const char *in = static_cast<const char *>(data);
+        size_t chunk_bytes = chunk_nsamps * sample_bytes;
+        size_t bytes = nsamps * sample_bytes;
+        while (bytes > 0) {
+            size_t n = std::min(bytes, chunk_bytes - current.size());
+            current.insert(current.end(), in, in + n);
+            in += n;
+            bytes -= n;
+            if (current.size() == chunk_bytes) {
+                submit();
+            }
+        }
+    }
+
+    /** @brief flush last chunk, write index and footer */
+    void close() {
+        using detail::write_value;
+        if (closed) {
+            return;
+        }
+        closed = true;
+        if (!current.empty()) {
+            submit();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+        output_thread.join();
+        if (error) {
+            stream.close();
+            std::rethrow_exception(error);
+        }
+        uint64_t index_offset = static_cast<uint64_t>(stream.tellp());
+        write_value(stream, static_cast<uint64_t>(index.size()));
+        for (const chunk_info &info : index) {
+            write_value(stream, info.offset);
+            write_value(stream, info.compressed_size);
+            write_value(stream, info.nsamps);
+        }
+        write_value(stream, index_offset);
+        stream.write(index_magic, sizeof(index_magic));
+        stream.close();
+    }
+
+protected:
+    struct job {
+        std::vector<char> raw, compressed;
+        bool started = false, done = false;
+    };
+
+    std::ofstream stream;
+    size_t element_size, sample_bytes, chunk_nsamps;
+    int level;
+    size_t max_in_flight;
+    std::vector<char> current;
+    std::vector<chunk_info> index;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::shared_ptr<job>> jobs; // in file order
+    bool stopping = false;
+    std::exception_ptr error; // first error of worker threads, chunks after it are not written
+    std::vector<std::thread> workers;
+    std::thread output_thread;
+
+    void check_error() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void submit() {
+        auto j = std::make_shared<job>();
+        j->raw.swap(current);
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return jobs.size() < max_in_flight; });
+        jobs.push_back(j);
+        lock.unlock();
+        condition.notify_all();
+    }
+
+    void work() {
+        std::vector<char> shuffled;
+        while (true) {
+            std::shared_ptr<job> j;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&]() {
+                    for (auto &k : jobs) {
+                        if (!k->started) {
+                            j = k;
+                            return true;
+                        }
+                    }
+                    return stopping;
+                });
+                if (!j) {
+                    return;
+                }
+                j->started = true;
+            }
+            shuffled.resize(j->raw.size());
+            bitshuffle(reinterpret_cast<const uint8_t *>(j->raw.data()), reinterpret_cast<uint8_t *>(shuffled.data()), j->raw.size() / element_size, element_size);
+            j->compressed.resize(ZSTD_compressBound(shuffled.size()));
+            size_t ret = ZSTD_compress(j->compressed.data(), j->compressed.size(), shuffled.data(), shuffled.size(), level);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                // an exception here would terminate the process, so it is passed to the caller's thread
+                if (ZSTD_isError(ret)) {
+                    if (!error) {
+                        error = std::make_exception_ptr(std::runtime_error(std::string("fbz: ") + ZSTD_getErrorName(ret)));
+                    }
+                } else {
+                    j->compressed.resize(ret);
+                }
+                j->done = true;
+            }
+            condition.notify_all();
+        }
+    }
+
+    void output() {
+        while (true) {
+            std::shared_ptr<job> j;
+            bool failed;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return (!jobs.empty() && jobs.front()->done) || (stopping && jobs.empty()); });
+                if (jobs.empty()) {
+                    return;
+                }
+                j = jobs.front();
+                jobs.pop_front();
+                failed = (error != nullptr);
+            }
+            condition.notify_all();
+            if (failed) {
+                continue;
+            }
+            index.push_back(chunk_info{static_cast<uint64_t>(stream.tellp()), j->compressed.size(), j->raw.size() / sample_bytes});
+            stream.write(j->compressed.data(), j->compressed.size());
+        }
+    }
+};
+
+/** @brief random access by time to a .fbz file */
+class reader {
+public:
+    std::ifstream stream;
+    uint32_t element_size = 0, codec = 0;
+    uint64_t sample_bytes = 0, chunk_nsamps = 0;
+    std::string sigproc_header;
+    std::vector<chunk_info> index;
+    uint64_t nsamples = 0;
+
+    explicit reader(const std::string &file_name) : stream(file_name, std::ios::binary) {
+        using detail::read_value;
+        char buffer[4];
+        stream.read(buffer, sizeof(buffer));
+        if (!stream || std::memcmp(buffer, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error(file_name + " is not a fbz file");
+        }
+        if (read_value<uint32_t>(stream) != version) {
+            throw std::runtime_error("fbz: unsupported version");
+        }
+        element_size = read_value<uint32_t>(stream);
+        codec = read_value<uint32_t>(stream);
+        if (codec != codec_zstd) {
+            throw std::runtime_error("fbz: unsupported codec");
+        }
+        sample_bytes = read_value<uint64_t>(stream);
+        chunk_nsamps = read_value<uint64_t>(stream);
+        sigproc_header.resize(read_value<uint64_t>(stream));
+        stream.read(&sigproc_header[0], sigproc_header.size());
+
+        stream.seekg(-static_cast<std::streamoff>(sizeof(uint64_t) + sizeof(index_magic)), std::ios::end);
+        uint64_t index_offset = read_value<uint64_t>(stream);
+        stream.read(buffer, sizeof(buffer));
+        if (!stream || std::memcmp(buffer, index_magic, sizeof(index_magic)) != 0) {
+            throw std::runtime_error(file_name + " has no fbz index, maybe not closed properly");
+        }
+        stream.seekg(index_offset);
+        index.resize(read_value<uint64_t>(stream));
+        for (chunk_info &info : index) {
+            info.offset = read_value<uint64_t>(stream);
+            info.compressed_size = read_value<uint64_t>(stream);
+            info.nsamps = read_value<uint64_t>(stream);
+            nsamples += info.nsamps;
+        }
+    }
+
+    /** @brief decompress chunk `i` to `out`, which should hold `index[i].nsamps * sample_bytes` bytes. thread-safe if `compressed` differs */
+    void decompress_chunk(size_t i, const std::vector<char> &compressed, void *out) const {
+        size_t size = index[i].nsamps * sample_bytes;
+        std::vector<char> shuffled(size);
+        size_t ret = ZSTD_decompress(shuffled.data(), size, compressed.data(), compressed.size());
+        if (ZSTD_isError(ret) || ret != size) {
+            throw std::runtime_error("fbz: corrupted chunk " + std::to_string(i));
+        }
+        bitunshuffle(reinterpret_cast<const uint8_t *>(shuffled.data()), static_cast<uint8_t *>(out), size / element_size, element_size);
+    }
+
+    /** @brief read compressed bytes of chunk `i` */
+    std::vector<char> read_chunk(size_t i) {
+        std::vector<char> compressed(index[i].compressed_size);
+        stream.seekg(index[i].offset);
+        stream.read(compressed.data(), compressed.size());
+        return compressed;
+    }
+
+    /** @brief read samples [begin, begin + nsamps) to `out`, returns count of samples read */
+    size_t read(size_t begin, size_t nsamps, void *out) {
+        char *o = static_cast<char *>(out);
+        size_t end = std::min(begin + nsamps, static_cast<size_t>(nsamples)), count = 0;
+        std::vector<char> chunk(chunk_nsamps * sample_bytes);
+        for (size_t i = begin / chunk_nsamps; i < index.size() && i * chunk_nsamps < end; i++) {
+            size_t chunk_begin = i * chunk_nsamps;
+            decompress_chunk(i, read_chunk(i), chunk.data());
+            size_t from = std::max(begin, chunk_begin), to = std::min(end, chunk_begin + index[i].nsamps);
+            std::memcpy(o + count * sample_bytes, chunk.data() + (from - chunk_begin) * sample_bytes, (to - from) * sample_bytes);
+            count += to - from;
+        }
+        return count;
+    }
+};
+
+} // namespace fbz
+
+#endif // _FBZ_HPP
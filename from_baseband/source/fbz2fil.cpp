@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// decompress a .fbz container back to a plain filterbank file for legacy tools.
+// the embedded sigproc header (if any) is written first, so the output is what the writer was given.
+
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "fbz.hpp"
+#include "parallel.hpp"
+#include "stopwatch.h"
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+
+    boost::program_options::options_description general_option("General Options");
+    using boost::program_options::value;
+    /* clang-format off */
+    general_option.add_options()
+        ("help,h", "Show help message")
+        ("input_file,f,i", value<std::string>(), "Input .fbz file")
+        ("output_file,o", value<std::string>(), "Output filterbank file")
+        ("start_sample", value<size_t>()->default_value(0), "First time sample to extract")
+        ("nsamps", value<size_t>(), "Number of time samples to extract, default to all")
+        ("no_header", "Don't write the embedded sigproc header")
+        ("threads", value<size_t>()->default_value(0), "Number of decompression threads, 0 to use all cores")
+    ;
+    /* clang-format on */
+    boost::program_options::positional_options_description p;
+    p.add("input_file", 1).add("output_file", 1);
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(general_option).positional(p).run(), vm);
+    boost::program_options::notify(vm);
+
+    if (vm.count("help") || !(vm.count("input_file") && vm.count("output_file"))) {
+        std::cout << general_option << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+
+    fbz::reader in(vm["input_file"].as<std::string>());
+    std::ofstream out(vm["output_file"].as<std::string>(), std::ios::binary);
+    if (!vm.count("no_header")) {
+        out.write(in.sigproc_header.data(), in.sigproc_header.size());
+    }
+    size_t thread_count = vm["threads"].as<size_t>();
+    if (thread_count == 0) {
+        thread_count = default_thread_count();
+    }
+
+    size_t begin = std::min(vm["start_sample"].as<size_t>(), static_cast<size_t>(in.nsamples));
+    size_t end = vm.count("nsamps") ? std::min(begin + vm["nsamps"].as<size_t>(), static_cast<size_t>(in.nsamples)) : static_cast<size_t>(in.nsamples);
+    std::cout << "element_size = " << in.element_size << ", " << "sample_bytes = " << in.sample_bytes << ", " << "chunk_nsamps = " << in.chunk_nsamps << ", "
+              << "chunks = " << in.index.size() << ", " << "nsamples = " << in.nsamples << std::endl;
+    if (begin >= end) {
+        return 0;
+    }
+
+    // decompress `thread_count` chunks at a time, write them in order
+    Stopwatch read_timer, decompress_timer, write_timer;
+    size_t first_chunk = begin / in.chunk_nsamps, last_chunk = (end - 1) / in.chunk_nsamps + 1;
+    std::vector<std::vector<char>> compressed(thread_count), raw(thread_count, std::vector<char>(in.chunk_nsamps * in.sample_bytes));
+    for (size_t group = first_chunk; group < last_chunk; group += thread_count) {
+        size_t count = std::min(thread_count, last_chunk - group);
+        read_timer.start();
+        for (size_t j = 0; j < count; j++) {
+            compressed[j] = in.read_chunk(group + j);
+        }
+        read_timer.stop();
+
+        decompress_timer.start();
+        parallel_for(count, thread_count, [&](size_t j) {
+            in.decompress_chunk(group + j, compressed[j], raw[j].data());
+        });
+        decompress_timer.stop();
+
+        write_timer.start();
+        for (size_t j = 0; j < count; j++) {
+            size_t chunk_begin = (group + j) * in.chunk_nsamps;
+            size_t from = std::max(begin, chunk_begin), to = std::min(end, chunk_begin + in.index[group + j].nsamps);
+            out.write(raw[j].data() + (from - chunk_begin) * in.sample_bytes, (to - from) * in.sample_bytes);
+        }
+        write_timer.stop();
+    }
+
+    std::cout << "read_timer: " << read_timer.getTime() << "  "
+              << "decompress_timer: " << decompress_timer.getTime() << "  "
+              << "write_timer: " << write_timer.getTime() << std::endl;
+    return 0;
+}
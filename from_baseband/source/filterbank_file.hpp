@@ -0,0 +1,314 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// memory-mapped access to sigproc filterbank files (and raw files without header),
+// blocks of samples & channels are viewed in place, no copy is made until values are unpacked.
+
+#pragma once
+#ifndef _FILTERBANK_FILE_HPP
+#define _FILTERBANK_FILE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sigproc.hpp"
+
+/** @brief read-only mapping of a whole file */
+class mapped_file {
+public:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    mapped_file() = default;
+
+    explicit mapped_file(const std::string &file_name) {
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + file_name);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + file_name);
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size > 0) {
+            void *ptr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot mmap " + file_name);
+            }
+            data = static_cast<const char *>(ptr);
+        }
+        ::close(fd);
+    }
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    mapped_file(mapped_file &&other) noexcept : data(other.data), size(other.size) {
+        other.data = nullptr;
+        other.size = 0;
+    }
+
+    mapped_file &operator=(mapped_file &&other) noexcept {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        return *this;
+    }
+
+    ~mapped_file() {
+        if (data) {
+            ::munmap(const_cast<char *>(data), size);
+        }
+    }
+
+    /** @brief hint kernel to read [offset, offset + length) ahead */
+    void prefetch(size_t offset, size_t length) const {
+        if (offset >= size) {
+            return;
+        }
+        static const size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        size_t begin = offset / page_size * page_size, end = std::min(offset + length, size);
+        ::madvise(const_cast<char *>(data) + begin, end - begin, MADV_WILLNEED);
+    }
+};
+
+namespace detail {
+
+/** @brief istream over memory for sigproc::read_header */
+struct memory_streambuf : public std::streambuf {
+    memory_streambuf(const char *begin, const char *end) {
+        char *b = const_cast<char *>(begin);
+        setg(b, b, const_cast<char *>(end));
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which = std::ios_base::in) override {
+        char *target = (dir == std::ios_base::beg) ? eback() + off : (dir == std::ios_base::cur) ? gptr() + off : egptr() + off;
+        if (!(which & std::ios_base::in) || target < eback() || target > egptr()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), target, egptr());
+        return pos_type(target - eback());
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in) override {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief view of samples [sample_begin, sample_begin + nsamps) and channels [chan_begin, chan_begin + nchans)
+ *        of one IF, pointing into the mapped file.
+ */
+class block_view {
+public:
+    const char *data = nullptr; // first byte of sample `sample_begin`
+    size_t sample_begin = 0, nsamps = 0;
+    size_t chan_begin = 0, nchans = 0;
+    size_t bytes_per_sample = 0;
+    size_t bit_offset = 0; // of channel `chan_begin` of selected IF inside a sample
+    int nbits = 32;
+
+    /** @brief pointer to bytes of sample `t` (relative to this view), starting at the byte containing first channel */
+    const char *row(size_t t) const {
+        return data + t * bytes_per_sample + bit_offset / 8;
+    }
+
+    /**
+     * @brief element `i` of type T from `p`. data follows a sigproc header of any length, so it is usually misaligned for T,
+     *        and is read by memcpy, which compiles to plain (vectorizable) unaligned loads
+     */
+    template <typename T>
+    static T load(const char *p, size_t i) {
+        T value;
+        std::memcpy(&value, p + i * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    /** @brief value of channel `c` of sample `t`, both relative to this view */
+    float value(size_t t, size_t c) const {
+        switch (nbits) {
+            case 32:
+                return load<float>(row(t), c);
+            case 16:
+                return load<uint16_t>(row(t), c);
+            case 8:
+                return load<uint8_t>(row(t), c);
+            default: {
+                // sigproc packs sub-byte samples from the lowest bits
+                size_t bit = bit_offset + c * nbits;
+                uint8_t byte = static_cast<uint8_t>(data[t * bytes_per_sample + bit / 8]);
+                return (byte >> (bit % 8)) & ((1u << nbits) - 1);
+            }
+        }
+    }
+
+    /** @brief unpack channels of sample `t` to `out`, `out` should hold `nchans` values */
+    template <typename T>
+    void unpack(size_t t, T *out) const {
+        const char *in = row(t);
+        switch (nbits) {
+            case 32:
+                if constexpr (std::is_same_v<T, float>) {
+                    std::memcpy(out, in, nchans * sizeof(float));
+                } else {
+                    for (size_t c = 0; c < nchans; c++) {
+                        out[c] = static_cast<T>(load<float>(in, c));
+                    }
+                }
+                break;
+            case 16:
+                for (size_t c = 0; c < nchans; c++) {
+                    out[c] = static_cast<T>(load<uint16_t>(in, c));
+                }
+                break;
+            case 8:
+                for (size_t c = 0; c < nchans; c++) {
+                    out[c] = static_cast<T>(load<uint8_t>(in, c));
+                }
+                break;
+            default:
+                for (size_t c = 0; c < nchans; c++) {
+                    out[c] = static_cast<T>(value(t, c));
+                }
+        }
+    }
+
+    /** @brief unpack whole view to `out`, time-major, row pitch is `nchans` */
+    template <typename T>
+    void unpack(T *out) const {
+        for (size_t t = 0; t < nsamps; t++) {
+            unpack(t, out + t * nchans);
+        }
+    }
+};
+
+class filterbank_file;
+
+/** @brief iterates blocks of `nsamps` samples, `step` samples apart, and prefetches the next block */
+class block_iterator {
+public:
+    const filterbank_file *file;
+    size_t begin, nsamps, step;
+    size_t chan_begin, nchans, if_index;
+
+    block_view operator*() const;
+    block_iterator &operator++();
+
+    /** @brief iteration ends after the block reaching end of file */
+    bool operator!=(const block_iterator &other) const {
+        return begin != other.begin;
+    }
+};
+
+struct block_range {
+    block_iterator first, last;
+
+    block_iterator begin() const {
+        return first;
+    }
+
+    block_iterator end() const {
+        return last;
+    }
+};
+
+class filterbank_file {
+public:
+    mapped_file file;
+    sigproc::header header;
+
+    /** @brief open a sigproc file, or a raw file described by `raw_header` if there's no sigproc header */
+    explicit filterbank_file(const std::string &file_name, const sigproc::header &raw_header = sigproc::header()) : file(file_name), header(raw_header) {
+        detail::memory_streambuf buffer(file.data, file.data + file.size);
+        std::istream stream(&buffer);
+        if (sigproc::is_sigproc(stream)) {
+            header = sigproc::read_header(stream);
+        } else {
+            header.header_size = 0;
+        }
+        if (header.nbits != 1 && header.nbits != 2 && header.nbits != 4 && header.nbits != 8 && header.nbits != 16 && header.nbits != 32) {
+            throw std::runtime_error("Unsupported nbits = " + std::to_string(header.nbits));
+        }
+        if ((static_cast<size_t>(header.nchans) * header.nbits) % 8 != 0) {
+            throw std::runtime_error("Channels of a sample should fill whole bytes");
+        }
+    }
+
+    size_t nsamples() const {
+        return (file.size - header.header_size) / header.bytes_per_sample();
+    }
+
+    const char *sample_data(size_t sample) const {
+        return file.data + header.header_size + sample * header.bytes_per_sample();
+    }
+
+    /** @brief zero-copy view of a block, ranges are clamped to the file */
+    block_view block(size_t sample_begin, size_t nsamps, size_t chan_begin = 0, size_t nchans = SIZE_MAX, size_t if_index = 0) const {
+        if (if_index >= static_cast<size_t>(header.nifs)) {
+            throw std::runtime_error("IF " + std::to_string(if_index) + " out of nifs = " + std::to_string(header.nifs));
+        }
+        block_view view;
+        view.sample_begin = std::min(sample_begin, nsamples());
+        view.nsamps = std::min(nsamps, nsamples() - view.sample_begin);
+        view.chan_begin = std::min(chan_begin, static_cast<size_t>(header.nchans));
+        view.nchans = std::min(nchans, header.nchans - view.chan_begin);
+        view.bytes_per_sample = header.bytes_per_sample();
+        view.bit_offset = (if_index * header.nchans + view.chan_begin) * header.nbits;
+        view.nbits = header.nbits;
+        view.data = sample_data(view.sample_begin);
+        return view;
+    }
+
+    void prefetch(size_t sample_begin, size_t nsamps) const {
+        file.prefetch(header.header_size + sample_begin * header.bytes_per_sample(), nsamps * header.bytes_per_sample());
+    }
+
+    /** @brief blocks of `nsamps` samples starting every `step` samples, i.e. consecutive blocks overlap by `nsamps - step` */
+    block_range blocks(size_t nsamps, size_t step, size_t chan_begin = 0, size_t nchans = SIZE_MAX, size_t if_index = 0) const {
+        if (step == 0) {
+            throw std::runtime_error("step of blocks should be positive");
+        }
+        if (if_index >= static_cast<size_t>(header.nifs)) {
+            throw std::runtime_error("IF " + std::to_string(if_index) + " out of nifs = " + std::to_string(header.nifs));
+        }
+        size_t n = nsamples(), count = 1;
+        if (n > nsamps) {
+            count += (n - nsamps + step - 1) / step;
+        }
+        prefetch(0, nsamps + step);
+        block_iterator first{this, 0, nsamps, step, chan_begin, nchans, if_index};
+        block_iterator last{this, count * step, nsamps, step, chan_begin, nchans, if_index};
+        return block_range{first, last};
+    }
+};
+
+inline block_view block_iterator::operator*() const {
+    return file->block(begin, nsamps, chan_begin, nchans, if_index);
+}
+
+inline block_iterator &block_iterator::operator++() {
+    begin += step;
+    file->prefetch(begin + step, nsamps);
+    return *this;
+}
+
+#endif // _FILTERBANK_FILE_HPP
@@ -14,6 +14,6 @@
 
 extern boost::program_options::variables_map vm;
 
-extern Stopwatch setup_timer, generate_timer, fft_timer, normalize_timer, copy_timer, write_timer;
+extern Stopwatch setup_timer, generate_timer, fft_timer, rfi_timer, normalize_timer, detect_timer, copy_timer, write_timer;
 
 #endif // _GLOBAL_VARIABLE_HPP
\ No newline at end of file
@@ -11,6 +11,10 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 template <typename Vec>
 void write_vector(Vec &vec, size_t width, size_t height, std::string name) {
@@ -45,4 +49,49 @@ void write_vector_binary(Vec &vec, size_t length, std::string name) {
     fclose(file_handle);
 }
 
+/** @brief file kept open for writes at byte offsets, e.g. of stripes of channel-major output; truncated on open unless `truncate` is false */
+class positional_file {
+  public:
+    positional_file(const std::string &name_, bool truncate) : name(name_) {
+        fd = open(name.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + name);
+        }
+    }
+    positional_file(const positional_file &) = delete;
+    positional_file &operator=(const positional_file &) = delete;
+    ~positional_file() {
+        close(fd);
+    }
+
+    void write_at(const void *data, size_t size, size_t offset) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t ret = pwrite(fd, static_cast<const char *>(data) + written, size - written, offset + written);
+            if (ret <= 0) {
+                throw std::runtime_error("Cannot write " + name);
+            }
+            written += ret;
+        }
+    }
+
+  private:
+    std::string name;
+    int fd;
+};
+
+/**
+ * @brief write `length` elements starting at `vec[begin]` to byte `offset` of file `name` without truncating it,
+ *        so that several processes can write their parts of a shared file
+ */
+template <typename Vec>
+void write_vector_binary_at(Vec &vec, size_t begin, size_t length, std::string name, size_t offset) {
+    typedef typename Vec::value_type E;
+    if (length == 0) {
+        return;
+    }
+    positional_file file(name, false);
+    file.write_at(&vec[begin], sizeof(E) * length, offset);
+}
+
 #endif // _IO_HPP
\ No newline at end of file
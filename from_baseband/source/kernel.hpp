@@ -6,40 +6,424 @@
  ***************************************************************************/
 
 #include "benchmark.hpp"
+#include "bluestein.hpp"
 #include "checks.hpp"
 #include "global_variable.hpp"
 #include "io.hpp"
 #include <boost/compute/command_queue.hpp>
 #include <boost/compute/container/vector.hpp>
+#include <boost/compute/memory/local_buffer.hpp>
+#include <boost/compute/utility/dim.hpp>
 #include <boost/compute/utility/source.hpp>
+#include <cmath>
 #include <clFFT.h>
+#include <functional>
+#include <vector>
 
 std::string kernel_source = BOOST_COMPUTE_STRINGIZE_SOURCE(
-    __kernel void generate(__global data_type *d_in, ulong nsamp /*, data_type dt*/) {
+    // counter-based random numbers, Philox2x32-10 (Salmon et al., 2011):
+    // each (counter, key) gives independent numbers, so any batch can be generated on its own, in any order
+    uint2 philox2x32(uint2 counter, uint key) {
+        for (int r = 0; r < 10; r++) {
+            uint hi = mul_hi(0xD256D193u, counter.x);
+            uint lo = 0xD256D193u * counter.x;
+            counter = (uint2)(hi ^ key ^ counter.y, lo);
+            key += 0x9E3779B9u;
+        }
+        return counter;
+    }
+
+    // two independent standard gaussian values of sample `i`, Box-Muller transform
+    data_type2 gaussian2(ulong i, uint key) {
+        uint2 r = philox2x32((uint2)((uint)i, (uint)(i >> 32)), key);
+        data_type u1 = ((data_type)r.x + 1.0f) * 2.3283064365386963e-10f; // (0, 1]
+        data_type u2 = (data_type)r.y * 2.3283064365386963e-10f;          // [0, 1)
+        data_type radius = sqrt(-2.0f * log(u1));
+        return (data_type2)(radius * cospi(2.0f * u2), radius * sinpi(2.0f * u2));
+    }
+
+    data_type cos_cycles(phase_type phase) {
+        return cospi((data_type)(2 * (phase - floor(phase))));
+    }
+
+    __constant int pulse_copies = 8;       // incoherent copies spread over pulse width
+    __constant long max_pulse_overlap = 16; // max count of periods overlapping in a dispersion sweep
+
+    // synthetic baseband of sample [sample_offset, sample_offset + nsamp) of each polarization:
+    // gaussian noise, tones and dispersed pulses. times are in samples and frequencies in cycles per sample.
+    // a pulse passes top of band at pulse_time + n * pulse_period, then sweeps down as a chirp with
+    // instantaneous sky frequency F(tau) = (tau / pulse_a + pulse_b) ^ (-1/2), from dispersion delay tau = pulse_a * (F^-2 - F_top^-2), pulse_b = F_top^-2.
+    // its phase is the integral 2 * pulse_a * (sqrt(tau / pulse_a + pulse_b) - sqrt(pulse_b)), minus f_dc * tau for baseband.
+    // pulse_a = 0 means no dispersion, pulse is then a burst of noise.
+    // pulse parameters are phase_type, as the phase is a small difference of large terms and times grow with sample index
+    __kernel void generate(__global data_type *d_in, ulong nsamp, ulong npol, ulong sample_offset, uint seed, data_type noise_sigma,
+                           __global const data_type *d_tones, ulong ntones, data_type pulse_amplitude, phase_type pulse_a, phase_type pulse_b,
+                           phase_type f_dc, phase_type tau_max, phase_type pulse_width, phase_type pulse_period, phase_type pulse_time) {
+        size_t i = get_global_id(0);
+        if (i >= nsamp) {
+            return;
+        }
+        ulong t = sample_offset + i;
+        data_type2 value = noise_sigma * gaussian2(t, seed);
+        data_type signal = 0;
+        for (ulong k = 0; k < ntones; k++) {
+            signal += d_tones[2 * k + 1] * cos_cycles((phase_type)t * d_tones[2 * k]);
+        }
+        if (pulse_amplitude != 0) {
+            phase_type tt = (phase_type)t - pulse_time;
+            long n_first = 0, n_last = 0;
+            if (pulse_period > 0) {
+                n_last = (long)floor(tt / pulse_period);
+                n_first = max((long)ceil((tt - tau_max - pulse_width) / pulse_period), n_last - max_pulse_overlap + 1);
+            }
+            for (long n = n_first; n <= n_last; n++) {
+                phase_type tau0 = tt - n * pulse_period;
+                if (pulse_a == 0) {
+                    if (tau0 >= 0 && tau0 < pulse_width) {
+                        signal += pulse_amplitude * gaussian2(t, seed ^ 0x5BD1E995u).x;
+                    }
+                    continue;
+                }
+                for (int c = 0; c < pulse_copies; c++) {
+                    phase_type tau = tau0 - pulse_width * c / pulse_copies;
+                    if (tau >= 0 && tau <= tau_max) {
+                        phase_type phase = 2 * pulse_a * (sqrt(tau / pulse_a + pulse_b) - sqrt(pulse_b)) - f_dc * tau;
+                        signal += pulse_amplitude * rsqrt((data_type)pulse_copies) * cos_cycles(phase + 0.618034f * c);
+                    }
+                }
+            }
+        }
+        d_in[i] = value.x + signal;
+        if (npol == 2) {
+            d_in[nsamp + i] = value.y + signal;
+        }
+    }
+
+    // input of dual polarization mode is interleaved as x0 y0 x1 y1 ...,
+    // while batched fft wants x0 x1 ... y0 y1 ...
+    __kernel void deinterleave_dual_pol(__global const data_type *d_in_raw, __global data_type *d_in, ulong nsamp) {
+        size_t i = get_global_id(0);
+        if (4 * i + 3 < nsamp) {
+            data_type8 v = vload8(i, d_in_raw);
+            vstore4(v.even, i, d_in);
+            vstore4(v.odd, i, d_in + nsamp);
+        } else {
+            for (size_t j = 4 * i; j < nsamp; j++) {
+                d_in[j] = d_in_raw[2 * j];
+                d_in[nsamp + j] = d_in_raw[2 * j + 1];
+            }
+        }
+    }
+
+    // zoom: shift channel `center` of full-band spectrum to baseband, low-pass filter and keep every `decimation`-th sample,
+    // then a complex fft of nsamp_seg / decimation points has the same channel width as full-band one.
+    // mixing phase e^(-2 pi i center n / nsamp_seg) has period nsamp_seg, so it only depends on position in a segment;
+    // (-1)^m then moves the band to middle of output, so that channels are contiguous.
+    // d_history holds last ntaps - 1 samples of previous batch of each polarization.
+    // the filter is causal and linear-phase, so output m is centred at input sample m * decimation - (ntaps - 1) / 2,
+    // i.e. zoom spectra lag full-band ones by (ntaps - 1) / 2 input samples.
+    __kernel void zoom_decimate(__global const data_type *d_in, __global const data_type *d_history, __global data_type2 *d_zoom, ulong nsamp, ulong nsamp_seg,
+                                ulong decimation, ulong center, __global const data_type *d_taps, ulong ntaps) {
+        size_t m = get_global_id(0), p = get_global_id(1);
+        size_t nsamp_out = nsamp / decimation;
+        if (m >= nsamp_out) {
+            return;
+        }
+        __global const data_type *in = d_in + p * nsamp;
+        __global const data_type *history = d_history + p * (ntaps - 1);
+        long n = (long)(m * decimation);
+        data_type phase = (data_type)(((ulong)n % nsamp_seg) * center % nsamp_seg) / nsamp_seg;
+        data_type step_phase = (data_type)center / nsamp_seg;
+        data_type2 w = (data_type2)(cospi(2 * phase), -sinpi(2 * phase));
+        data_type2 step = (data_type2)(cospi(2 * step_phase), sinpi(2 * step_phase)); // going back one sample
+        data_type2 acc = (data_type2)(0, 0);
+        for (ulong k = 0; k < ntaps; k++) {
+            long idx = n - (long)k;
+            data_type x = (idx >= 0) ? in[idx] : history[(long)(ntaps - 1) + idx];
+            acc += (d_taps[k] * x) * w;
+            w = (data_type2)(w.x * step.x - w.y * step.y, w.x * step.y + w.y * step.x);
+        }
+        if ((m % (nsamp_seg / decimation)) & 1) {
+            acc = -acc;
+        }
+        d_zoom[p * nsamp_out + m] = acc;
+    }
+
+    // spectral kurtosis estimator of `m` power spectra (Nita & Gary, 2010):
+    //     SK = (m + 1) / (m - 1) * (m * S2 / S1^2 - 1),
+    // which is 1 +- 2 / sqrt(m) for gaussian noise, so channels out of 1 +- threshold * 2 / sqrt(m) are flagged.
+    // one work-item per channel per block of `block` segments, flagged if flagged in any polarization
+    __kernel void spectral_kurtosis(__global const data_type *d_out_complex, __global uchar *d_chan_mask, ulong nchan, ulong nseg, ulong nseg_valid, ulong npol, ulong block, data_type threshold) {
+        size_t c = get_global_id(0), b = get_global_id(1);
+        if (c >= nchan) {
+            return;
+        }
+        size_t s_begin = b * block, s_end = min((size_t)(s_begin + block), (size_t)nseg_valid);
+        uchar flag = 0;
+        if (s_end > s_begin + 1) {
+            data_type m = s_end - s_begin;
+            for (size_t p = 0; p < npol; p++) {
+                data_type s1 = 0, s2 = 0;
+                for (size_t s = s_begin; s < s_end; s++) {
+                    size_t idx = 2 * (nchan * (p * nseg + s) + c);
+                    data_type power = d_out_complex[idx] * d_out_complex[idx] + d_out_complex[idx + 1] * d_out_complex[idx + 1];
+                    s1 += power;
+                    s2 += power * power;
+                }
+                if (s1 > 0) {
+                    data_type sk = (m + 1) / (m - 1) * (m * s2 / (s1 * s1) - 1);
+                    flag |= (fabs(sk - 1) > threshold * 2 / sqrt(m));
+                }
+            }
+        }
+        d_chan_mask[nchan * b + c] = flag;
+    }
+
+    // total power of each spectrum, one work-group per spectrum, local size must be power of 2
+    __kernel void segment_power(__global const data_type *d_out_complex, __global data_type *d_seg_power, ulong nchan, __local data_type *scratch) {
+        size_t s = get_group_id(0), l = get_local_id(0), n = get_local_size(0);
+        __global const data_type *x = d_out_complex + 2 * nchan * s;
+        data_type sum = 0;
+        for (size_t j = l; j < nchan; j += n) {
+            sum += x[2 * j] * x[2 * j] + x[2 * j + 1] * x[2 * j + 1];
+        }
+        scratch[l] = sum;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (size_t k = n / 2; k > 0; k /= 2) {
+            if (l < k) {
+                scratch[l] += scratch[l + k];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (l == 0) {
+            d_seg_power[s] = scratch[0];
+        }
+    }
+
+    // flag segments whose total power (summed over polarizations) is more than `threshold` sigma away from mean of this batch.
+    // there are only `nseg` values, so a single work-item is enough
+    __kernel void flag_segments(__global const data_type *d_seg_power, __global uchar *d_time_mask, ulong nseg, ulong nseg_valid, ulong npol, data_type threshold) {
+        data_type sum = 0, sum2 = 0;
+        if (nseg_valid == 0) {
+            for (size_t s = 0; s < nseg; s++) {
+                d_time_mask[s] = 0;
+            }
+            return;
+        }
+        for (size_t s = 0; s < nseg_valid; s++) {
+            data_type p = 0;
+            for (size_t q = 0; q < npol; q++) {
+                p += d_seg_power[q * nseg + s];
+            }
+            sum += p;
+            sum2 += p * p;
+        }
+        data_type mean = sum / nseg_valid, sigma = sqrt(max(sum2 / nseg_valid - mean * mean, (data_type)0));
+        for (size_t s = 0; s < nseg; s++) {
+            data_type p = 0;
+            for (size_t q = 0; q < npol; q++) {
+                p += d_seg_power[q * nseg + s];
+            }
+            d_time_mask[s] = (s < nseg_valid && sigma > 0 && fabs(p - mean) > threshold * sigma);
+        }
+    }
+
+    __kernel void apply_rfi_mask(__global data_type *d_out_complex, __global const uchar *d_chan_mask, __global const uchar *d_time_mask, ulong nchan, ulong nseg, ulong npol, ulong block) {
+        size_t c = get_global_id(0), s = get_global_id(1);
+        if (c >= nchan || s >= nseg) {
+            return;
+        }
+        if (d_chan_mask[nchan * (s / block) + c] || d_time_mask[s]) {
+            for (size_t p = 0; p < npol; p++) {
+                size_t idx = 2 * (nchan * (p * nseg + s) + c);
+                d_out_complex[idx] = 0;
+                d_out_complex[idx + 1] = 0;
+            }
+        }
+    }
+
+    // zero-DM filter (Eatough et al., 2009): subtract mean of unmasked channels [band_first, band_first + band_nchan) from them in each
+    // detected spectrum, so channels cut away from output don't bias it. only the first IF (total intensity) is filtered.
+    // one work-group per spectrum, local size must be power of 2
+    __kernel void zero_dm(__global data_type *d_out_real, __global const uchar *d_chan_mask, ulong nchan, ulong nifs, ulong block, ulong band_first, ulong band_nchan,
+                          __local data_type *scratch) {
+        size_t s = get_group_id(0), l = get_local_id(0), n = get_local_size(0);
+        __global data_type *x = d_out_real + nifs * nchan * s + band_first;
+        __global const uchar *mask = d_chan_mask + nchan * (s / block) + band_first;
+        data_type sum = 0, count = 0;
+        for (size_t j = l; j < band_nchan; j += n) {
+            if (!mask[j]) {
+                sum += x[j];
+                count += 1;
+            }
+        }
+        scratch[l] = sum;
+        scratch[n + l] = count;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (size_t k = n / 2; k > 0; k /= 2) {
+            if (l < k) {
+                scratch[l] += scratch[l + k];
+                scratch[n + l] += scratch[n + l + k];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        data_type mean = (scratch[n] > 0) ? scratch[0] / scratch[n] : 0;
+        for (size_t j = l; j < band_nchan; j += n) {
+            if (!mask[j]) {
+                x[j] -= mean;
+            }
+        }
+    }
+
+    // tiled corner turn of detected spectra d_out_real ([seg][nchan_row]) to stripes of `block` channels, each stripe is [seg][block]
+    // (the last one may be narrower), so block = 1 gives plain channel-major data.
+    // output channel j is input channel (flip ? chan_first + nchan_out - 1 - j : chan_first + j), work-groups are TILE x TILE
+    __kernel void corner_turn(__global const data_type *d_out_real, __global data_type *d_out_turned, ulong nchan_row, ulong nseg, ulong chan_first, ulong nchan_out, int flip, ulong block) {
+        __local data_type tile[TILE][TILE + 1]; // + 1 to avoid bank conflicts when reading columns
+        size_t lx = get_local_id(0), ly = get_local_id(1);
+        size_t j0 = get_group_id(0) * TILE, s0 = get_group_id(1) * TILE;
+        // read rows: x is channel
+        size_t j = j0 + lx, s = s0 + ly;
+        if (j < nchan_out && s < nseg) {
+            size_t c = flip ? chan_first + nchan_out - 1 - j : chan_first + j;
+            tile[ly][lx] = d_out_real[nchan_row * s + c];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        // write columns: x is segment
+        j = j0 + ly;
+        s = s0 + lx;
+        if (j < nchan_out && s < nseg) {
+            size_t stripe = j / block, width = min((size_t)block, (size_t)(nchan_out - stripe * block));
+            d_out_turned[stripe * block * nseg + s * width + (j - stripe * block)] = tile[lx][ly];
+        }
+    }
+
+    // detect kernels: each work-item loads 4 complex numbers as a data_type8 and stores 4 real numbers,
+    // the tail that doesn't fill a vector is done by the last work-items one by one
+    __kernel void detect_power(__global const data_type *d_out_complex, __global data_type *d_out_real, ulong n) {
+        size_t i = get_global_id(0);
+        if (4 * i + 3 < n) {
+            data_type8 c = vload8(i, d_out_complex);
+            vstore4(c.even * c.even + c.odd * c.odd, i, d_out_real);
+        } else {
+            for (size_t j = 4 * i; j < n; j++) {
+                d_out_real[j] = d_out_complex[2 * j] * d_out_complex[2 * j] + d_out_complex[2 * j + 1] * d_out_complex[2 * j + 1];
+            }
+        }
+    }
+
+    __kernel void detect_amplitude(__global const data_type *d_out_complex, __global data_type *d_out_real, ulong n) {
         size_t i = get_global_id(0);
-        /*
-        data_type t = dt * ((data_type)i);
-        data_type x = t / 400.0f;
-        d_in[i] = sin(2*M_PI_F*40*x) + ((data_type)0.5) * sin(2*M_PI_F*90*x);
-        */
-        uint m = 0xCAFEBABEDEADCAFE; //
-        uint t = i & 0x3F;
-        for (uint i = 0; i < t; i++) {
-            m = (m << 1) | (m >> 63);
+        if (4 * i + 3 < n) {
+            data_type8 c = vload8(i, d_out_complex);
+            vstore4(sqrt(c.even * c.even + c.odd * c.odd), i, d_out_real);
+        } else {
+            for (size_t j = 4 * i; j < n; j++) {
+                d_out_real[j] = sqrt(d_out_complex[2 * j] * d_out_complex[2 * j] + d_out_complex[2 * j + 1] * d_out_complex[2 * j + 1]);
+            }
         }
-        d_in[i] = m / 1e18;
     }
 
-    __kernel void normalize_complex_number(__global data_type *d_out_complex, __global data_type *d_out_real) {
+    __kernel void detect_real(__global const data_type *d_out_complex, __global data_type *d_out_real, ulong n) {
         size_t i = get_global_id(0);
-        d_out_real[i] = (sqrt(d_out_complex[2 * i] * d_out_complex[2 * i] + d_out_complex[2 * i + 1] * d_out_complex[2 * i + 1]));
+        if (4 * i + 3 < n) {
+            data_type8 c = vload8(i, d_out_complex);
+            vstore4(c.even, i, d_out_real);
+        } else {
+            for (size_t j = 4 * i; j < n; j++) {
+                d_out_real[j] = d_out_complex[2 * j];
+            }
+        }
     }
 
-    __kernel void pick_real_in_complex_number(__global data_type *d_out_complex, __global data_type *d_out_real) {
+    // dual polarization: x spectra are in [0, n) and y spectra in [n, 2n) of d_out_complex, in complex numbers
+    __kernel void detect_stokes_i(__global const data_type *d_out_complex, __global data_type *d_out_real, ulong n) {
         size_t i = get_global_id(0);
-        d_out_real[i] = d_out_complex[2 * i];
+        __global const data_type *x = d_out_complex, *y = d_out_complex + 2 * n;
+        if (4 * i + 3 < n) {
+            data_type8 a = vload8(i, x), b = vload8(i, y);
+            vstore4(a.even * a.even + a.odd * a.odd + b.even * b.even + b.odd * b.odd, i, d_out_real);
+        } else {
+            for (size_t j = 4 * i; j < n; j++) {
+                d_out_real[j] = x[2 * j] * x[2 * j] + x[2 * j + 1] * x[2 * j + 1] + y[2 * j] * y[2 * j] + y[2 * j + 1] * y[2 * j + 1];
+            }
+        }
+    }
+
+    // full stokes, output of segment s is I, Q, U, V of `nchan` channels each, i.e. nifs = 4 in sigproc layout
+    // I = |X|^2 + |Y|^2, Q = |X|^2 - |Y|^2, U = 2 Re(X Y*), V = -2 Im(X Y*)
+    __kernel void detect_stokes_iquv(__global const data_type *d_out_complex, __global data_type *d_out_real, ulong nchan, ulong nseg) {
+        size_t i = get_global_id(0), s = get_global_id(1);
+        if (s >= nseg) {
+            return;
+        }
+        __global const data_type *x = d_out_complex + 2 * nchan * s, *y = d_out_complex + 2 * nchan * (nseg + s);
+        __global data_type *out = d_out_real + 4 * nchan * s;
+        if (4 * i + 3 < nchan) {
+            data_type8 a = vload8(i, x), b = vload8(i, y);
+            data_type4 xx = a.even * a.even + a.odd * a.odd, yy = b.even * b.even + b.odd * b.odd;
+            data_type4 re = a.even * b.even + a.odd * b.odd, im = a.odd * b.even - a.even * b.odd;
+            vstore4(xx + yy, i, out);
+            vstore4(xx - yy, i, out + nchan);
+            vstore4(((data_type)2) * re, i, out + 2 * nchan);
+            vstore4(((data_type)-2) * im, i, out + 3 * nchan);
+        } else {
+            for (size_t j = 4 * i; j < nchan; j++) {
+                data_type xx = x[2 * j] * x[2 * j] + x[2 * j + 1] * x[2 * j + 1], yy = y[2 * j] * y[2 * j] + y[2 * j + 1] * y[2 * j + 1];
+                data_type re = x[2 * j] * y[2 * j] + x[2 * j + 1] * y[2 * j + 1], im = x[2 * j + 1] * y[2 * j] - x[2 * j] * y[2 * j + 1];
+                out[j] = xx + yy;
+                out[nchan + j] = xx - yy;
+                out[2 * nchan + j] = ((data_type)2) * re;
+                out[3 * nchan + j] = ((data_type)-2) * im;
+            }
+        }
+    }
+
+    data_type2 complex_multiply(data_type2 a, data_type2 b) {
+        return (data_type2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+    }
+
+    // Bluestein (chirp-z) fft of length n that clFFT doesn't support, see set_up_bluestein():
+    //     X_k = w_k * sum_j (x_j * w_j) * conj(w_(k-j)),  w_j = exp(-i pi j^2 / n)
+    // the sum is a circular convolution of length `length` >= 2n - 1, done by clFFT of that length.
+    // segment b of input is x[b * n, (b + 1) * n), real or complex
+    __kernel void bluestein_premultiply(__global const data_type *d_x, __global data_type2 *d_a, __global const data_type2 *d_chirp, ulong n, ulong length, int complex_input) {
+        size_t j = get_global_id(0), b = get_global_id(1);
+        if (j >= length) {
+            return;
+        }
+        data_type2 value = (data_type2)(0, 0);
+        if (j < n) {
+            value = complex_input ? complex_multiply(vload2(b * n + j, d_x), d_chirp[j]) : d_x[b * n + j] * d_chirp[j];
+        }
+        d_a[b * length + j] = value;
+    }
+
+    // spectrum of (x * w) times spectrum of conj(w), i.e. `d_kernel`
+    __kernel void bluestein_multiply(__global data_type2 *d_a, __global const data_type2 *d_kernel, ulong length) {
+        size_t k = get_global_id(0), b = get_global_id(1);
+        if (k >= length) {
+            return;
+        }
+        d_a[b * length + k] = complex_multiply(d_a[b * length + k], d_kernel[k]);
+    }
+
+    // first `nout` values of the convolution times w_k, output segments are `nout` apart like clFFT's
+    __kernel void bluestein_postmultiply(__global const data_type2 *d_a, __global data_type2 *d_out, __global const data_type2 *d_chirp, ulong length, ulong nout) {
+        size_t k = get_global_id(0), b = get_global_id(1);
+        if (k >= nout) {
+            return;
+        }
+        d_out[b * nout + k] = complex_multiply(d_a[b * length + k], d_chirp[k]);
     });
 
+template <typename data_type>
+class clfft_caller;
+
+template <typename data_type>
+void call_fft_shared(std::vector<clfft_caller<data_type> *> callers, std::vector<data_type> &h_in, std::vector<std::vector<data_type> *> h_out_complex, std::vector<std::vector<data_type> *> h_out_real,
+                     bool dump = false);
+
 template <typename data_type>
 class clfft_caller {
 
@@ -48,139 +432,698 @@ public:
     size_t in_nsamp_seg, out_nsamp_seg;
     size_t seg_count;
     size_t in_nsamp, out_nsamp;
-    boost::compute::vector<data_type> d_in, d_out_complex, d_out_real, d_in_tmp;
+    size_t npol, nifs; // count of input polarizations, and count of IFs (stokes parameters) in output
+    size_t nseg_valid; // count of segments holding data in current batch, less than seg_count only for the last batch
+    boost::compute::vector<data_type> d_in, d_out_complex, d_out_real, d_in_tmp, d_in_raw;
+    clfft_caller *input_source = nullptr; // see share_input()
     clfftPlanHandle plan_handle;
     boost::compute::kernel generate_kernel;
-    boost::compute::kernel normalize_kernel;
-    boost::compute::kernel pick_real_kernel;
+    boost::compute::kernel deinterleave_kernel;
+    boost::compute::kernel detect_kernel;
+    size_t detect_bytes = 0; // read & written by detect(), to compare its throughput with memory bandwidth of device
+    size_t fft_nsamps = 0;   // input samples of all polarizations transformed, including zoom stage
+    size_t generate_work_group_size, deinterleave_work_group_size, detect_work_group_size;
     bool inverse;
 
-    clfft_caller(boost::compute::command_queue queue_, size_t in_nsamp_seg_, size_t seg_count_, size_t out_nsamp_seg_, bool inverse_)
+    // RFI mitigation between fft and detect, see mitigate_rfi()
+    size_t rfi_sk_block;
+    data_type rfi_sk_threshold, rfi_time_threshold;
+    bool rfi_zero_dm;
+    size_t band_first, band_nchan; // channels of fft output kept in output, see set_output_band()
+    boost::compute::vector<cl_uchar> d_chan_mask, d_time_mask;
+    boost::compute::vector<data_type> d_seg_power;
+    boost::compute::kernel spectral_kurtosis_kernel, segment_power_kernel, flag_segments_kernel, apply_rfi_mask_kernel, zero_dm_kernel;
+    size_t reduce_work_group_size;
+    std::ofstream rfi_mask_stream;
+
+    // channel-major output, see set_channel_major_output()
+    static constexpr size_t corner_turn_tile = 16;
+    bool channel_major = false, channel_major_flip;
+    size_t chan_first, nchan_out, channel_block;
+    boost::compute::vector<data_type> d_out_turned;
+    boost::compute::kernel corner_turn_kernel;
+
+    // output handed over batch by batch instead of kept for whole file, see set_output_sink()
+    std::function<void(size_t, size_t, const std::vector<data_type> &)> output_sink;
+    std::vector<data_type> h_out_batch;
+
+    // synthetic input generated on device instead of uploaded, see set_generator()
+    bool generating = false;
+    size_t generate_nseg;
+    cl_ulong generate_sample_offset;
+    cl_uint generate_seed;
+    data_type generate_noise_sigma;
+    boost::compute::vector<data_type> d_tones; // (frequency, amplitude) pairs
+    data_type pulse_amplitude;
+    double pulse_a, pulse_b, f_dc, tau_max, pulse_width, pulse_period, pulse_time; // phase_type in kernel, see set_phase_arg()
+    bool phase_double;
+
+    // zoom mode, see zoom_decimate()
+    size_t zoom_decimation, zoom_center;
+    boost::compute::vector<data_type> d_zoom, d_zoom_history, d_zoom_taps;
+    boost::compute::kernel zoom_kernel;
+
+    // Bluestein fft for lengths clFFT doesn't support, see bluestein_premultiply(); plan_handle is then a complex one of bluestein_length
+    size_t fft_length, bluestein_length = 0; // 0 if not used
+    boost::compute::vector<data_type> d_bluestein, d_bluestein_chirp, d_bluestein_kernel;
+    boost::compute::kernel bluestein_premultiply_kernel, bluestein_multiply_kernel, bluestein_postmultiply_kernel;
+
+    /**
+     * @param zoom_decimation_ if not 1, mix channel `zoom_center_` to baseband, low-pass filter and decimate by this before fft,
+     *                         `out_nsamp_seg_` should then be in_nsamp_seg_ / zoom_decimation_
+     */
+    clfft_caller(boost::compute::command_queue queue_, size_t in_nsamp_seg_, size_t seg_count_, size_t out_nsamp_seg_, bool inverse_, size_t npol_ = 1, size_t nifs_ = 1,
+                 size_t zoom_decimation_ = 1, size_t zoom_center_ = 0)
         : queue(queue_), in_nsamp_seg(in_nsamp_seg_), seg_count(seg_count_), out_nsamp_seg(out_nsamp_seg_), inverse(inverse_),
-          in_nsamp(in_nsamp_seg * seg_count), out_nsamp(out_nsamp_seg * seg_count), d_in(in_nsamp), d_out_complex(2 * out_nsamp), d_out_real(out_nsamp) {
+          in_nsamp(in_nsamp_seg * seg_count), out_nsamp(out_nsamp_seg * seg_count), npol(npol_), nifs(nifs_), zoom_decimation(zoom_decimation_), zoom_center(zoom_center_),
+          d_in(npol * in_nsamp), d_out_complex(2 * npol * out_nsamp), d_out_real(nifs * out_nsamp) {
 
         namespace bc = boost::compute;
         bc::context context = queue.get_context();
         bc::device device = queue.get_device();
+        nseg_valid = seg_count;
+        if (npol != 1 && (npol != 2 || inverse)) {
+            throw std::runtime_error("Unsupported polarization count " + std::to_string(npol));
+        }
+        if (nifs != 1 && (nifs != 4 || npol != 2)) {
+            throw std::runtime_error("Unsupported IF count " + std::to_string(nifs) + " with " + std::to_string(npol) + " polarization(s)");
+        }
         clfftSetupData clfft_setup_data;
         clfftInitSetupData(&clfft_setup_data);
         clfftSetup(&clfft_setup_data);
         clfftDim dim = CLFFT_1D;
         size_t cl_lengths[1];
-        if (!inverse) {
+        if (zoom_decimation != 1) {
+            if (inverse || in_nsamp_seg % zoom_decimation != 0 || out_nsamp_seg != in_nsamp_seg / zoom_decimation || out_nsamp_seg % 2 != 0) {
+                throw std::runtime_error("Invalid zoom: nsamp_seg = " + std::to_string(in_nsamp_seg) + ", decimation = " + std::to_string(zoom_decimation));
+            }
+            cl_lengths[0] = out_nsamp_seg;
+        } else if (!inverse) {
             cl_lengths[0] = in_nsamp_seg;
         } else {
             cl_lengths[0] = out_nsamp_seg;
         }
-        if (!check_fft_length(cl_lengths[0])) {
-            throw std::runtime_error("Unsupported fft length " + std::to_string(cl_lengths[0]));
+        fft_length = cl_lengths[0];
+        if (!check_fft_length(fft_length)) {
+            if (inverse) {
+                throw std::runtime_error("Unsupported fft length " + std::to_string(fft_length) + " of inverse transform");
+            }
+            bluestein_length = next_fft_length(2 * fft_length - 1);
+            cl_lengths[0] = bluestein_length;
         }
         clfftCreateDefaultPlan(&plan_handle, context.get(), dim, cl_lengths);
         clfftSetPlanPrecision(plan_handle, CLFFT_SINGLE);
-        if (!inverse) {
+        if (bluestein_length) {
+            clfftSetLayout(plan_handle, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+        } else if (zoom_decimation != 1) {
+            clfftSetLayout(plan_handle, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+        } else if (!inverse) {
             clfftSetLayout(plan_handle, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
         } else {
             clfftSetLayout(plan_handle, CLFFT_HERMITIAN_PLANAR, CLFFT_REAL);
             d_in_tmp = bc::vector<data_type>(in_nsamp);
             bc::fill(d_in_tmp.begin(), d_in_tmp.end(), static_cast<data_type>(0));
         }
-        clfftSetResultLocation(plan_handle, CLFFT_OUTOFPLACE);
-        clfftSetPlanBatchSize(plan_handle, seg_count);
-        clfftSetPlanDistance(plan_handle, in_nsamp_seg, out_nsamp_seg);
+        if (npol == 2) {
+            d_in_raw = bc::vector<data_type>(2 * in_nsamp);
+        }
+        clfftSetResultLocation(plan_handle, bluestein_length ? CLFFT_INPLACE : CLFFT_OUTOFPLACE);
+        // both polarizations are transformed by one plan, x segments first then y segments
+        clfftSetPlanBatchSize(plan_handle, npol * seg_count);
+        if (bluestein_length) {
+            clfftSetPlanDistance(plan_handle, bluestein_length, bluestein_length);
+        } else {
+            clfftSetPlanDistance(plan_handle, (zoom_decimation != 1) ? out_nsamp_seg : in_nsamp_seg, out_nsamp_seg);
+        }
         clfftBakePlan(plan_handle, 1, &(queue.get()), NULL, NULL);
 
-        bc::program program = bc::program::build_with_source(kernel_source, context, std::string("-Ddata_type=") + bc::type_name<data_type>());
+        std::string type_name = bc::type_name<data_type>();
+        std::string build_options = "-Ddata_type=" + type_name + " -Ddata_type2=" + type_name + "2" + " -Ddata_type4=" + type_name + "4" + " -Ddata_type8=" + type_name + "8" + " -DTILE=" + std::to_string(corner_turn_tile);
+        // phase of generated signals grows with sample index, use double for it if possible
+        std::string source = kernel_source;
+        phase_double = device.supports_extension("cl_khr_fp64");
+        if (phase_double) {
+            source = "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n" + source;
+            build_options += " -Dphase_type=double";
+        } else {
+            build_options += " -Dphase_type=" + type_name;
+        }
+        bc::program program = bc::program::build_with_source(source, context, build_options);
         generate_kernel = bc::kernel(program, "generate");
-        normalize_kernel = bc::kernel(program, "normalize_complex_number");
-        pick_real_kernel = bc::kernel(program, "pick_real_in_complex_number");
+        deinterleave_kernel = bc::kernel(program, "deinterleave_dual_pol");
+        std::string detect_mode = vm["detect"].as<std::string>();
+        if (vm.count("pick_real_part")) {
+            detect_mode = "real";
+        }
+        if (npol == 2) {
+            detect_kernel = bc::kernel(program, (nifs == 4) ? "detect_stokes_iquv" : "detect_stokes_i");
+        } else if (detect_mode == "power" || detect_mode == "amplitude" || detect_mode == "real") {
+            detect_kernel = bc::kernel(program, "detect_" + detect_mode);
+        } else {
+            throw std::runtime_error("Unknown detect mode " + detect_mode);
+        }
+        generate_work_group_size = work_group_size(generate_kernel);
+        deinterleave_work_group_size = work_group_size(deinterleave_kernel);
+        detect_work_group_size = work_group_size(detect_kernel);
+
+        // a block of spectral kurtosis covers whole batch if disabled, so that masks always have the same shape
+        rfi_sk_block = vm["rfi_sk_block"].as<size_t>();
+        if (rfi_sk_block != 0 && seg_count % rfi_sk_block != 0) {
+            throw std::runtime_error("rfi_sk_block = " + std::to_string(rfi_sk_block) + " should divide seg_count = " + std::to_string(seg_count));
+        }
+        rfi_sk_threshold = vm["rfi_sk_threshold"].as<float>();
+        rfi_time_threshold = vm["rfi_time_threshold"].as<float>();
+        rfi_zero_dm = (vm.count("rfi_zero_dm") != 0);
+        band_first = 0;
+        band_nchan = out_nsamp_seg;
+        d_chan_mask = bc::vector<cl_uchar>(out_nsamp_seg * (rfi_sk_block ? seg_count / rfi_sk_block : 1));
+        d_time_mask = bc::vector<cl_uchar>(seg_count);
+        d_seg_power = bc::vector<data_type>(npol * seg_count);
+        bc::fill(d_chan_mask.begin(), d_chan_mask.end(), static_cast<cl_uchar>(0));
+        bc::fill(d_time_mask.begin(), d_time_mask.end(), static_cast<cl_uchar>(0));
+        spectral_kurtosis_kernel = bc::kernel(program, "spectral_kurtosis");
+        segment_power_kernel = bc::kernel(program, "segment_power");
+        flag_segments_kernel = bc::kernel(program, "flag_segments");
+        apply_rfi_mask_kernel = bc::kernel(program, "apply_rfi_mask");
+        zero_dm_kernel = bc::kernel(program, "zero_dm");
+        corner_turn_kernel = bc::kernel(program, "corner_turn");
+        zoom_kernel = bc::kernel(program, "zoom_decimate");
+        if (zoom_decimation != 1) {
+            set_up_zoom();
+        }
+        bluestein_premultiply_kernel = bc::kernel(program, "bluestein_premultiply");
+        bluestein_multiply_kernel = bc::kernel(program, "bluestein_multiply");
+        bluestein_postmultiply_kernel = bc::kernel(program, "bluestein_postmultiply");
+        if (bluestein_length) {
+            set_up_bluestein();
+        }
+        reduce_work_group_size = std::min(work_group_size(segment_power_kernel), work_group_size(zero_dm_kernel));
+        while (reduce_work_group_size & (reduce_work_group_size - 1)) {
+            reduce_work_group_size &= (reduce_work_group_size - 1);
+        }
+        if (vm.count("rfi_mask_file")) {
+            rfi_mask_stream.open(vm["rfi_mask_file"].as<std::string>(), std::ios::binary);
+        }
+    }
+
+    /**
+     * @brief windowed-sinc low-pass filter for zoom_decimate(), cut off at half of decimated sample rate.
+     *        gain is `zoom_decimation` so that output has the same scale as full-band fft.
+     *        group delay is (ntaps - 1) / 2 = zoom_taps * zoom_decimation / 2 input samples
+     */
+    void set_up_zoom() {
+        namespace bc = boost::compute;
+        size_t ntaps = vm["zoom_taps"].as<size_t>() * zoom_decimation + 1;
+        if (ntaps - 1 > in_nsamp_seg) {
+            throw std::runtime_error("zoom filter of " + std::to_string(ntaps) + " taps is longer than a segment");
+        }
+        std::vector<data_type> h_taps(ntaps);
+        double cutoff = 0.5 / zoom_decimation, sum = 0.0; // in cycles per input sample
+        for (size_t k = 0; k < ntaps; k++) {
+            double x = k - (ntaps - 1) / 2.0;
+            double sinc = (x == 0.0) ? 1.0 : std::sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            double window = 0.42 - 0.5 * std::cos(2 * M_PI * k / (ntaps - 1)) + 0.08 * std::cos(4 * M_PI * k / (ntaps - 1)); // Blackman
+            h_taps[k] = sinc * window;
+            sum += h_taps[k];
+        }
+        for (auto &tap : h_taps) {
+            tap = tap * zoom_decimation / sum;
+        }
+        d_zoom_taps = bc::vector<data_type>(h_taps.begin(), h_taps.end(), queue);
+        d_zoom_history = bc::vector<data_type>(npol * (ntaps - 1));
+        reset_stream();
+        d_zoom = bc::vector<data_type>(2 * npol * out_nsamp);
+    }
+
+    /** @brief forget samples kept from previous batches, so that next batch is treated as start of a new file */
+    void reset_stream() {
+        if (zoom_decimation != 1) {
+            boost::compute::fill(d_zoom_history.begin(), d_zoom_history.end(), static_cast<data_type>(0), queue);
+        }
+    }
+
+    /**
+     * @brief chirp w_j = exp(-i pi j^2 / n) and spectrum of conj(w) wrapped around, see bluestein::tables().
+     *        the spectrum is made by a plan of one segment, used once here. backward transform of clFFT is scaled by 1 / bluestein_length,
+     *        so output has the same scale as a plain fft of `fft_length`
+     */
+    void set_up_bluestein() {
+        namespace bc = boost::compute;
+        size_t n = fft_length, length = bluestein_length;
+        std::vector<data_type> h_chirp, h_kernel;
+        bluestein::tables(n, length, h_chirp, h_kernel);
+        d_bluestein_chirp = bc::vector<data_type>(h_chirp.begin(), h_chirp.end(), queue);
+        d_bluestein_kernel = bc::vector<data_type>(h_kernel.begin(), h_kernel.end(), queue);
+        d_bluestein = bc::vector<data_type>(2 * npol * seg_count * length);
+
+        clfftPlanHandle kernel_plan;
+        size_t cl_lengths[1] = {length};
+        clfftCreateDefaultPlan(&kernel_plan, queue.get_context().get(), CLFFT_1D, cl_lengths);
+        clfftSetPlanPrecision(kernel_plan, CLFFT_SINGLE);
+        clfftSetLayout(kernel_plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+        clfftSetResultLocation(kernel_plan, CLFFT_INPLACE);
+        clfftBakePlan(kernel_plan, 1, &(queue.get()), NULL, NULL);
+        clfftEnqueueTransform(kernel_plan, CLFFT_FORWARD, 1, &(queue.get()), 0, NULL, NULL, &(d_bluestein_kernel.get_buffer().get()), NULL, NULL);
+        queue.finish();
+        clfftDestroyPlan(&kernel_plan);
+    }
+
+    /** @brief forward fft of segments in `in` (real, or complex for zoom mode) to d_out_complex, by clFFT or Bluestein */
+    void fft_forward(boost::compute::vector<data_type> &in, bool complex_input) {
+        namespace bc = boost::compute;
+        if (!bluestein_length) {
+            clfftEnqueueTransform(plan_handle, CLFFT_FORWARD, 1, &(queue.get()), 0, NULL, NULL, &(in.get_buffer().get()), &(d_out_complex.get_buffer().get()), NULL);
+            return;
+        }
+        size_t nbatch = npol * seg_count, length = bluestein_length;
+        bluestein_premultiply_kernel.set_args(in.get_buffer().get(), d_bluestein.get_buffer().get(), d_bluestein_chirp.get_buffer().get(), static_cast<cl_ulong>(fft_length),
+                                              static_cast<cl_ulong>(length), static_cast<cl_int>(complex_input));
+        size_t local_size = work_group_size(bluestein_premultiply_kernel);
+        queue.enqueue_nd_range_kernel(bluestein_premultiply_kernel, bc::dim(0, 0), bc::dim(round_up(length, local_size), nbatch), bc::dim(local_size, 1));
+        clfftEnqueueTransform(plan_handle, CLFFT_FORWARD, 1, &(queue.get()), 0, NULL, NULL, &(d_bluestein.get_buffer().get()), NULL, NULL);
+
+        bluestein_multiply_kernel.set_args(d_bluestein.get_buffer().get(), d_bluestein_kernel.get_buffer().get(), static_cast<cl_ulong>(length));
+        local_size = work_group_size(bluestein_multiply_kernel);
+        queue.enqueue_nd_range_kernel(bluestein_multiply_kernel, bc::dim(0, 0), bc::dim(round_up(length, local_size), nbatch), bc::dim(local_size, 1));
+        clfftEnqueueTransform(plan_handle, CLFFT_BACKWARD, 1, &(queue.get()), 0, NULL, NULL, &(d_bluestein.get_buffer().get()), NULL, NULL);
+
+        bluestein_postmultiply_kernel.set_args(d_bluestein.get_buffer().get(), d_out_complex.get_buffer().get(), d_bluestein_chirp.get_buffer().get(), static_cast<cl_ulong>(length),
+                                               static_cast<cl_ulong>(out_nsamp_seg));
+        local_size = work_group_size(bluestein_postmultiply_kernel);
+        queue.enqueue_nd_range_kernel(bluestein_postmultiply_kernel, bc::dim(0, 0), bc::dim(round_up(out_nsamp_seg, local_size), nbatch), bc::dim(local_size, 1));
+    }
+
+    /** @brief d_in -> d_zoom, and keep tail of this batch as history of next one */
+    void zoom() {
+        namespace bc = boost::compute;
+        size_t ntaps = d_zoom_taps.size(), nsamp_out = in_nsamp / zoom_decimation;
+        size_t local_size = work_group_size(zoom_kernel);
+        zoom_kernel.set_args(input().get_buffer().get(), d_zoom_history.get_buffer().get(), d_zoom.get_buffer().get(), static_cast<cl_ulong>(in_nsamp), static_cast<cl_ulong>(in_nsamp_seg),
+                             static_cast<cl_ulong>(zoom_decimation), static_cast<cl_ulong>(zoom_center), d_zoom_taps.get_buffer().get(), static_cast<cl_ulong>(ntaps));
+        queue.enqueue_nd_range_kernel(zoom_kernel, bc::dim(0, 0), bc::dim(round_up(nsamp_out, local_size), npol), bc::dim(local_size, 1));
+        size_t valid_end = nseg_valid * in_nsamp_seg, history_size = ntaps - 1;
+        for (size_t p = 0; p < npol; p++) {
+            auto history = d_zoom_history.begin() + p * history_size;
+            auto in_end = input().begin() + p * in_nsamp + valid_end;
+            if (valid_end >= history_size) {
+                bc::copy(in_end - history_size, in_end, history, queue);
+            } else {
+                // valid part of batch is shorter than the filter, so newest part of old history stays in front of it
+                bc::vector<data_type> kept(history + valid_end, history + history_size, queue);
+                bc::copy(kept.begin(), kept.end(), history, queue);
+                bc::copy(in_end - valid_end, in_end, history + (history_size - valid_end), queue);
+            }
+        }
+    }
+
+    /** @brief largest multiple of preferred work-group size multiple of `kernel` not exceeding --work_group_size */
+    size_t work_group_size(const boost::compute::kernel &kernel) {
+        boost::compute::device device = queue.get_device();
+        size_t multiple = kernel.get_work_group_info<size_t>(device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE);
+        size_t size = std::min(kernel.get_work_group_info<size_t>(device, CL_KERNEL_WORK_GROUP_SIZE), vm["work_group_size"].as<size_t>());
+        if (size >= multiple) {
+            size -= size % multiple;
+        }
+        return std::max(size, static_cast<size_t>(1));
+    }
+
+    static size_t round_up(size_t n, size_t m) {
+        return (n + m - 1) / m * m;
     }
 
     void print_info() {
         /* clang-format off */
         std::cout << "in_nsamp_seg = " << in_nsamp_seg << "  " << "out_nsamp_seg = " << out_nsamp_seg << "  " << "seg_count = " << seg_count << std::endl
-                  << "in_nsamp = " << in_nsamp << "  " << "out_nsamp = " << out_nsamp << std::endl;
+                  << "in_nsamp = " << in_nsamp << "  " << "out_nsamp = " << out_nsamp << "  " << "npol = " << npol << "  " << "nifs = " << nifs << std::endl;
         /* clang-format on */
         std::cout << "d_in size : " << d_in.get_buffer().get_memory_size() << " bytes" << std::endl;
     }
 
-    void generate() {
-        generate_kernel.set_args(d_in.get_buffer().get(), static_cast<cl_ulong>(in_nsamp));
-        queue.enqueue_1d_range_kernel(generate_kernel, 0, in_nsamp, 0);
+    /**
+     * @brief generate `nseg_all_` segments of input on device instead of uploading, starting at segment `first_segment`,
+     *        `sample_rate` and frequencies of --gen_* options are in MHz, times are in ms
+     */
+    void set_generator(size_t nseg_all_, size_t first_segment, float sample_rate) {
+        namespace bc = boost::compute;
+        constexpr double dispersion_constant = 4.148808e3; // s * MHz^2 / (pc cm^-3)
+        generating = true;
+        generate_nseg = nseg_all_;
+        generate_sample_offset = first_segment * in_nsamp_seg;
+        generate_seed = vm["gen_seed"].as<cl_uint>();
+        generate_noise_sigma = vm["gen_noise_sigma"].as<float>();
+
+        std::vector<float> tone_freq, tone_amplitude;
+        if (vm.count("gen_tone_freq")) {
+            tone_freq = vm["gen_tone_freq"].as<std::vector<float>>();
+        }
+        if (vm.count("gen_tone_amplitude")) {
+            tone_amplitude = vm["gen_tone_amplitude"].as<std::vector<float>>();
+        }
+        std::vector<data_type> h_tones;
+        for (size_t k = 0; k < tone_freq.size(); k++) {
+            h_tones.push_back(tone_freq[k] / sample_rate);
+            h_tones.push_back(k < tone_amplitude.size() ? tone_amplitude[k] : 1.0f);
+        }
+        // a silent tone if there's none, as kernel argument can't be an empty buffer
+        h_tones.resize(std::max(h_tones.size(), static_cast<size_t>(2)));
+        d_tones = bc::vector<data_type>(h_tones.begin(), h_tones.end(), queue);
+
+        // sky frequencies relative to sample rate, in cycles per sample; times in samples
+        double sky_freq = vm["gen_sky_freq"].as<float>(), dm = vm["gen_dm"].as<float>();
+        double samples_per_ms = sample_rate * 1e3;
+        if (sky_freq <= 0) {
+            throw std::runtime_error("gen_sky_freq should be positive");
+        }
+        double top = (sky_freq + sample_rate / 2) / sample_rate;
+        f_dc = sky_freq / sample_rate;
+        pulse_amplitude = vm["gen_pulse_amplitude"].as<float>();
+        pulse_a = dispersion_constant * dm * 1e6 / sample_rate;
+        pulse_b = 1.0 / (top * top);
+        tau_max = pulse_a * (1.0 / (f_dc * f_dc) - pulse_b);
+        pulse_width = vm["gen_pulse_width"].as<float>() * samples_per_ms;
+        pulse_period = vm["gen_pulse_period"].as<float>() * samples_per_ms;
+        pulse_time = vm["gen_pulse_time"].as<float>() * samples_per_ms;
+    }
+
+    /** @brief set argument `index` of `kernel` of type phase_type, which is double if device supports it */
+    void set_phase_arg(boost::compute::kernel &kernel, size_t index, double value) {
+        if (phase_double) {
+            kernel.set_arg(index, static_cast<cl_double>(value));
+        } else {
+            kernel.set_arg(index, static_cast<cl_float>(value));
+        }
+    }
+
+    /** @brief fill d_in with batch `batch_index` of synthetic input */
+    void generate(size_t batch_index) {
+        cl_ulong sample_offset = generate_sample_offset + batch_index * in_nsamp;
+        generate_kernel.set_args(d_in.get_buffer().get(), static_cast<cl_ulong>(in_nsamp), static_cast<cl_ulong>(npol), sample_offset, generate_seed, generate_noise_sigma,
+                                 d_tones.get_buffer().get(), static_cast<cl_ulong>(d_tones.size() / 2), pulse_amplitude);
+        size_t index = 9;
+        for (double value : {pulse_a, pulse_b, f_dc, tau_max, pulse_width, pulse_period, pulse_time}) {
+            set_phase_arg(generate_kernel, index++, value);
+        }
+        queue.enqueue_1d_range_kernel(generate_kernel, 0, round_up(in_nsamp, generate_work_group_size), generate_work_group_size);
     }
 
-    void call_fft(std::vector<data_type> &h_in, std::vector<data_type> &h_out_complex, std::vector<data_type> &h_out_real) {
+    /** @brief upload `nseg` segments of all polarizations starting at `h_in_begin` into d_in, the rest of d_in is filled with 0 */
+    template <typename Iterator>
+    void upload(Iterator h_in_begin, size_t nseg) {
         namespace bc = boost::compute;
-        size_t iteration = h_in.size() / in_nsamp;
-        size_t in_offset = 0, out_offset = 0, out_part_offset = 0;
+        size_t nsamp = nseg * in_nsamp_seg;
+        if (npol == 1) {
+            bc::copy(h_in_begin, h_in_begin + nsamp, d_in.begin());
+            bc::fill(d_in.begin() + nsamp, d_in.end(), static_cast<data_type>(0));
+        } else {
+            bc::copy(h_in_begin, h_in_begin + 2 * nsamp, d_in_raw.begin());
+            bc::fill(d_in_raw.begin() + 2 * nsamp, d_in_raw.end(), static_cast<data_type>(0));
+            deinterleave_kernel.set_args(d_in_raw.get_buffer().get(), d_in.get_buffer().get(), static_cast<cl_ulong>(in_nsamp));
+            queue.enqueue_1d_range_kernel(deinterleave_kernel, 0, round_up((in_nsamp + 3) / 4, deinterleave_work_group_size), deinterleave_work_group_size);
+        }
+    }
+
+    bool rfi_enabled() {
+        return rfi_sk_block != 0 || rfi_time_threshold > 0 || rfi_zero_dm || rfi_mask_stream.is_open();
+    }
+
+    /** 
+     * @brief flag channels by spectral kurtosis of every `rfi_sk_block` segments and segments by total power,
+     *        then set flagged values of d_out_complex to 0
+     */
+    void mitigate_rfi() {
+        namespace bc = boost::compute;
+        size_t block = (rfi_sk_block ? rfi_sk_block : seg_count), nblock = seg_count / block;
+        size_t local_size = std::min(static_cast<size_t>(64), work_group_size(spectral_kurtosis_kernel));
+        if (rfi_sk_block) {
+            spectral_kurtosis_kernel.set_args(d_out_complex.get_buffer().get(), d_chan_mask.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg), static_cast<cl_ulong>(seg_count),
+                                              static_cast<cl_ulong>(nseg_valid), static_cast<cl_ulong>(npol), static_cast<cl_ulong>(block), rfi_sk_threshold);
+            queue.enqueue_nd_range_kernel(spectral_kurtosis_kernel, bc::dim(0, 0), bc::dim(round_up(out_nsamp_seg, local_size), nblock), bc::dim(local_size, 1));
+        }
+        if (rfi_time_threshold > 0) {
+            segment_power_kernel.set_args(d_out_complex.get_buffer().get(), d_seg_power.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg));
+            segment_power_kernel.set_arg(3, bc::local_buffer<data_type>(reduce_work_group_size));
+            queue.enqueue_1d_range_kernel(segment_power_kernel, 0, npol * seg_count * reduce_work_group_size, reduce_work_group_size);
+            flag_segments_kernel.set_args(d_seg_power.get_buffer().get(), d_time_mask.get_buffer().get(), static_cast<cl_ulong>(seg_count), static_cast<cl_ulong>(nseg_valid),
+                                          static_cast<cl_ulong>(npol), rfi_time_threshold);
+            queue.enqueue_task(flag_segments_kernel);
+        }
+        if (rfi_sk_block || rfi_time_threshold > 0) {
+            apply_rfi_mask_kernel.set_args(d_out_complex.get_buffer().get(), d_chan_mask.get_buffer().get(), d_time_mask.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg),
+                                           static_cast<cl_ulong>(seg_count), static_cast<cl_ulong>(npol), static_cast<cl_ulong>(block));
+            queue.enqueue_nd_range_kernel(apply_rfi_mask_kernel, bc::dim(0, 0), bc::dim(round_up(out_nsamp_seg, local_size), seg_count), bc::dim(local_size, 1));
+        }
+    }
+
+    /** @brief channels [band_first_, band_first_ + band_nchan_) of fft output are kept in output, zero-DM filter takes its mean over them only */
+    void set_output_band(size_t band_first_, size_t band_nchan_) {
+        if (band_first_ + band_nchan_ > out_nsamp_seg) {
+            throw std::runtime_error("output band exceeds " + std::to_string(out_nsamp_seg) + " channels");
+        }
+        band_first = band_first_;
+        band_nchan = band_nchan_;
+    }
+
+    void zero_dm() {
+        size_t block = (rfi_sk_block ? rfi_sk_block : seg_count);
+        zero_dm_kernel.set_args(d_out_real.get_buffer().get(), d_chan_mask.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg), static_cast<cl_ulong>(nifs), static_cast<cl_ulong>(block),
+                                static_cast<cl_ulong>(band_first), static_cast<cl_ulong>(band_nchan));
+        zero_dm_kernel.set_arg(7, boost::compute::local_buffer<data_type>(2 * reduce_work_group_size));
+        queue.enqueue_1d_range_kernel(zero_dm_kernel, 0, seg_count * reduce_work_group_size, reduce_work_group_size);
+    }
 
-        std::vector<data_type> h_in_tmp(in_nsamp), h_out_complex_tmp(2 * out_nsamp), h_out_real_tmp(out_nsamp);
-        for (size_t i = 0; i < iteration; i++) {
+    /**
+     * @brief append masks of this batch to sidecar file: `nseg_valid / rfi_sk_block` (rounded up, or 1 if disabled) rows of
+     *        `out_nsamp_seg` uint8 channel flags in fft order, then `nseg_valid` uint8 segment flags.
+     *        only the caller owning input (first --nsamp_seg) writes masks, others sharing its input don't, see share_input()
+     */
+    void write_rfi_mask() {
+        size_t nblock_valid = (rfi_sk_block ? (nseg_valid + rfi_sk_block - 1) / rfi_sk_block : 1);
+        std::vector<cl_uchar> h_chan_mask(nblock_valid * out_nsamp_seg), h_time_mask(nseg_valid);
+        boost::compute::copy(d_chan_mask.begin(), d_chan_mask.begin() + h_chan_mask.size(), h_chan_mask.begin());
+        boost::compute::copy(d_time_mask.begin(), d_time_mask.begin() + h_time_mask.size(), h_time_mask.begin());
+        rfi_mask_stream.write(reinterpret_cast<const char *>(h_chan_mask.data()), h_chan_mask.size());
+        rfi_mask_stream.write(reinterpret_cast<const char *>(h_time_mask.data()), h_time_mask.size());
+    }
+
+    /**
+     * @brief make call_fft() corner-turn channels [chan_first_, chan_first_ + nchan_out_) of each batch on device, and write them to
+     *        the sink set by set_output_sink(), which should be set after this.
+     */
+    void set_channel_major_output(size_t chan_first_, size_t nchan_out_, bool flip_, size_t channel_block_) {
+        if (inverse || nifs != 1) {
+            throw std::runtime_error("channel-major output requires forward transform and 1 IF");
+        }
+        channel_major = true;
+        chan_first = chan_first_;
+        nchan_out = nchan_out_;
+        channel_major_flip = flip_;
+        channel_block = std::max(channel_block_, static_cast<size_t>(1));
+        d_out_turned = boost::compute::vector<data_type>(nchan_out * seg_count);
+    }
+
+    /**
+     * @brief `sink_(batch_index, nseg_valid, out)` is called with each batch once it is downloaded, instead of keeping it in h_out_complex & h_out_real,
+     *        so that output of a file is never held whole. set again for each file in batch mode, or set an empty one to keep output again.
+     *        with channel-major output, `out` holds stripes of `channel_block` channels, the one of channel c starts at `c * seg_count`
+     *        and has `nseg_valid` segments, time-major inside, i.e. channel-major if `channel_block` is 1;
+     *        otherwise `out` holds `nseg_valid` detected spectra of `nifs * out_nsamp_seg` values each.
+     */
+    void set_output_sink(std::function<void(size_t, size_t, const std::vector<data_type> &)> sink_) {
+        output_sink = std::move(sink_);
+        h_out_batch.resize(output_sink ? (channel_major ? nchan_out * seg_count : nifs * out_nsamp) : 0);
+    }
+
+    void corner_turn() {
+        namespace bc = boost::compute;
+        corner_turn_kernel.set_args(d_out_real.get_buffer().get(), d_out_turned.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg), static_cast<cl_ulong>(seg_count),
+                                    static_cast<cl_ulong>(chan_first), static_cast<cl_ulong>(nchan_out), static_cast<cl_int>(channel_major_flip), static_cast<cl_ulong>(channel_block));
+        queue.enqueue_nd_range_kernel(corner_turn_kernel, bc::dim(0, 0), bc::dim(round_up(nchan_out, corner_turn_tile), round_up(seg_count, corner_turn_tile)), bc::dim(corner_turn_tile, corner_turn_tile));
+    }
+
+
+    /** @brief d_out_complex -> d_out_real, one work-item per 4 channels */
+    void detect() {
+        if (nifs == 4) {
+            size_t vector_count = (out_nsamp_seg + 3) / 4;
+            size_t local_size = std::min(detect_work_group_size, round_up(vector_count, 8));
+            detect_kernel.set_args(d_out_complex.get_buffer().get(), d_out_real.get_buffer().get(), static_cast<cl_ulong>(out_nsamp_seg), static_cast<cl_ulong>(seg_count));
+            queue.enqueue_nd_range_kernel(detect_kernel, boost::compute::dim(0, 0), boost::compute::dim(round_up(vector_count, local_size), seg_count), boost::compute::dim(local_size, 1));
+        } else {
+            detect_kernel.set_args(d_out_complex.get_buffer().get(), d_out_real.get_buffer().get(), static_cast<cl_ulong>(out_nsamp));
+            queue.enqueue_1d_range_kernel(detect_kernel, 0, round_up((out_nsamp + 3) / 4, detect_work_group_size), detect_work_group_size);
+        }
+    }
+
+    /** @brief count of whole segments to transform, in h_in or generated */
+    size_t segment_count(const std::vector<data_type> &h_in) const {
+        return generating ? generate_nseg : h_in.size() / (npol * in_nsamp_seg);
+    }
+
+    /** @brief upload (or generate) batch `i` of `nseg_all` segments to d_in */
+    void load_batch(std::vector<data_type> &h_in, size_t i, size_t nseg_all) {
+        nseg_valid = std::min(seg_count, nseg_all - i * seg_count);
+        if (generating) {
+            start_timer(generate_timer);
+            generate(i);
+            stop_timer(generate_timer);
+        } else {
             start_timer(copy_timer);
-            bc::copy(h_in.begin() + in_offset, h_in.begin() + in_offset + in_nsamp, d_in.begin());
-            bc::copy(h_in.begin() + in_offset, h_in.begin() + in_offset + in_nsamp, h_in_tmp.begin());
+            upload(h_in.begin() + i * npol * in_nsamp, nseg_valid);
             stop_timer(copy_timer);
+        }
+    }
 
-            start_timer(fft_timer);
-            if (!inverse) {
-                clfftEnqueueTransform(plan_handle, CLFFT_FORWARD, 1, &(queue.get()), 0, NULL, NULL, &(d_in.get_buffer().get()), &(d_out_complex.get_buffer().get()), NULL);
-            } else {
-                cl_mem d_ins[2] = {(d_in.get_buffer().get()), d_in_tmp.get_buffer().get()};
-                clfftEnqueueTransform(plan_handle, CLFFT_BACKWARD, 1, &(queue.get()), 0, NULL, NULL, &d_ins[0], &(d_out_real.get_buffer().get()), NULL);
-            }
-            stop_timer(fft_timer);
+    /** @brief use d_in of `source` as input, which should have the same batch length, so one upload is shared by several resolutions */
+    void share_input(clfft_caller &source) {
+        if (source.npol != npol || source.in_nsamp != in_nsamp || inverse || source.inverse) {
+            throw std::runtime_error("Cannot share input of different batch length");
+        }
+        input_source = &source;
+        d_in = boost::compute::vector<data_type>();
+        d_in_raw = boost::compute::vector<data_type>();
+        // masks are written for the caller owning input only
+        rfi_mask_stream.close();
+    }
 
+    boost::compute::vector<data_type> &input() {
+        return input_source ? input_source->d_in : d_in;
+    }
+
+    /** @brief fft, rfi mitigation and detection of current batch `i` in d_in, then download to h_out_complex & h_out_real (or channel-major output) */
+    void transform_batch(size_t i, std::vector<data_type> &h_out_complex, std::vector<data_type> &h_out_real) {
+        namespace bc = boost::compute;
+        if (input_source) {
+            nseg_valid = input_source->nseg_valid * input_source->in_nsamp_seg / in_nsamp_seg;
+        }
+        // a coarser resolution may have no whole segment in the last batch, then there's nothing to output,
+        // and zoom history, rfi statistics and masks are left as they are
+        if (nseg_valid == 0) {
+            return;
+        }
+        size_t out_offset = i * out_nsamp;
+
+        // zoom stage is counted as part of fft
+        start_timer(fft_timer);
+        if (zoom_decimation != 1) {
+            zoom();
+            fft_forward(d_zoom, true);
+        } else if (!inverse) {
+            fft_forward(input(), false);
+        } else {
+            cl_mem d_ins[2] = {(d_in.get_buffer().get()), d_in_tmp.get_buffer().get()};
+            clfftEnqueueTransform(plan_handle, CLFFT_BACKWARD, 1, &(queue.get()), 0, NULL, NULL, &d_ins[0], &(d_out_real.get_buffer().get()), NULL);
+        }
+        stop_timer(fft_timer);
+        fft_nsamps += npol * in_nsamp;
+
+        start_timer(rfi_timer);
+        if (!inverse && rfi_enabled()) {
+            mitigate_rfi();
+        }
+        stop_timer(rfi_timer);
+
+        start_timer(normalize_timer);
+        if (!inverse) {
+            start_timer(detect_timer);
+            detect();
+            stop_timer(detect_timer);
+            detect_bytes += (2 * npol + nifs) * out_nsamp * sizeof(data_type);
+        }
+        stop_timer(normalize_timer);
+
+        start_timer(rfi_timer);
+        if (!inverse && rfi_zero_dm) {
+            zero_dm();
+        }
+        if (!inverse && rfi_mask_stream.is_open()) {
+            write_rfi_mask();
+        }
+        stop_timer(rfi_timer);
+
+        if (channel_major) {
             start_timer(normalize_timer);
-            if (!inverse) {
-                if (vm.count("pick_real_part")) {
-                    pick_real_kernel.set_args(d_out_complex.get_buffer().get(), d_out_real.get_buffer().get());
-                    queue.enqueue_1d_range_kernel(pick_real_kernel, 0, out_nsamp, 0);
-                } else {
-                    normalize_kernel.set_args(d_out_complex.get_buffer().get(), d_out_real.get_buffer().get());
-                    queue.enqueue_1d_range_kernel(normalize_kernel, 0, out_nsamp, 0);
-                }
-            }
+            corner_turn();
             stop_timer(normalize_timer);
+        }
 
-            start_timer(copy_timer);
-            // bc::copy(d_in.begin(), d_in.end(), h_in.begin() + in_offset);
-            bc::copy(d_out_complex.begin(), d_out_complex.end(), h_out_complex.begin() + 2 * out_offset);
-            bc::copy(d_out_real.begin(), d_out_real.end(), h_out_real.begin() + out_offset);
-            if (i == 0) {
-                bc::copy(h_out_complex.begin() + 2 * out_offset, h_out_complex.begin() + 2 * out_offset + 2 * out_nsamp, h_out_complex_tmp.begin());
-                bc::copy(h_out_real.begin() + out_offset, h_out_real.begin() + out_offset + out_nsamp, h_out_real_tmp.begin());
-            }
-            // queue.enqueue_read_buffer_rect(d_out_real.get_buffer(),
-            //                                /* buffer_offset = */ bc::dim(fmin_id, 0, 0).data(),
-            //                                /* host_offset = */ bc::dim(fmin_id, seg_count * i, 0).data(),
-            //                                /* region = */ bc::dim(out_part_nsamp_seg, seg_count, 1).data(),
-            //                                /* buffer_row_pitch = */ out_nsamp_seg,
-            //                                /* buffer_slice_pitch = */ 0,
-            //                                /* host_row_pitch = */ out_part_nsamp_seg,
-            //                                /* host_slice_pitch = */ 0,
-            //                                &h_out_part[0]);
-            stop_timer(copy_timer);
-            if (i == 0) {
-                start_timer(write_timer);
-                write_vector(h_in_tmp, in_nsamp_seg, seg_count, "h_in_tmp-" + std::to_string(i) + ".txt");
-                write_vector(h_out_complex_tmp, out_nsamp_seg * 2, seg_count, "h_out_complex_tmp-" + std::to_string(i) + ".txt");
-                write_vector(h_out_real_tmp, out_nsamp_seg, seg_count, "h_out_real_tmp-" + std::to_string(i) + ".txt");
-                stop_timer(write_timer);
+        start_timer(copy_timer);
+        if (output_sink) {
+            if (channel_major) {
+                // stripes are laid out by seg_count, so all of them are read
+                bc::copy(d_out_turned.begin(), d_out_turned.end(), h_out_batch.begin(), queue);
+            } else {
+                bc::copy(d_out_real.begin(), d_out_real.begin() + nifs * out_nsamp_seg * nseg_valid, h_out_batch.begin(), queue);
             }
+        } else if (!channel_major) {
+            // complex output of a batch is [pol][seg][chan], keep that for each batch on host
+            size_t complex_nsamp = 2 * out_nsamp_seg * nseg_valid;
+            for (size_t p = 0; p < npol; p++) {
+                bc::copy(d_out_complex.begin() + p * 2 * out_nsamp, d_out_complex.begin() + p * 2 * out_nsamp + complex_nsamp, h_out_complex.begin() + 2 * npol * out_offset + p * complex_nsamp);
+            }
+            bc::copy(d_out_real.begin(), d_out_real.begin() + nifs * out_nsamp_seg * nseg_valid, h_out_real.begin() + nifs * out_offset);
+        }
+        stop_timer(copy_timer);
 
-            std::cout << "fft_timer: " << fft_timer.getTime() << "  "
-                      << "normalize_timer: " << normalize_timer.getTime() << "  "
-                      << "copy_timer: " << copy_timer.getTime()
-                      << "    \r";
-            std::cout.flush();
-
-            in_offset += in_nsamp;
-            out_offset += out_nsamp;
-            //out_part_offset += out_part_nsamp;
+        if (output_sink) {
+            output_sink(i, nseg_valid, h_out_batch);
         }
     }
 
-    void teardown() {
+    /** @brief write first batch of input and output as text, for debugging */
+    void dump_batch(size_t i) {
+        namespace bc = boost::compute;
+        std::vector<data_type> h_in_tmp(input().size()), h_out_complex_tmp(d_out_complex.size()), h_out_real_tmp(d_out_real.size());
+        start_timer(copy_timer);
+        bc::copy(input().begin(), input().end(), h_in_tmp.begin());
+        bc::copy(d_out_complex.begin(), d_out_complex.end(), h_out_complex_tmp.begin());
+        bc::copy(d_out_real.begin(), d_out_real.end(), h_out_real_tmp.begin());
+        stop_timer(copy_timer);
+        start_timer(write_timer);
+        write_vector(h_in_tmp, in_nsamp_seg, npol * seg_count, "h_in_tmp-" + std::to_string(i) + ".txt");
+        write_vector(h_out_complex_tmp, out_nsamp_seg * 2, npol * seg_count, "h_out_complex_tmp-" + std::to_string(i) + ".txt");
+        write_vector(h_out_real_tmp, out_nsamp_seg, nifs * seg_count, "h_out_real_tmp-" + std::to_string(i) + ".txt");
+        stop_timer(write_timer);
+    }
+
+    /** @brief transform all whole segments in h_in (or generated ones), the last batch may have less than `seg_count` segments */
+    void call_fft(std::vector<data_type> &h_in, std::vector<data_type> &h_out_complex, std::vector<data_type> &h_out_real) {
+        call_fft_shared<data_type>({this}, h_in, {&h_out_complex}, {&h_out_real});
+    }
+
+    /** @param teardown_library clFFT is set up once per process, only tear it down with the last plan */
+    void teardown(bool teardown_library = true) {
         clfftDestroyPlan(&plan_handle);
-        clfftTeardown();
+        if (teardown_library) {
+            clfftTeardown();
+        }
+    }
+};
+
+/**
+ * @brief each batch of input is uploaded once by callers[0] and transformed by all `callers`, which share its d_in,
+ *        output of callers[k] goes to h_out_complex[k] & h_out_real[k]. first batch is written as text if `dump`
+ */
+template <typename data_type>
+void call_fft_shared(std::vector<clfft_caller<data_type> *> callers, std::vector<data_type> &h_in, std::vector<std::vector<data_type> *> h_out_complex, std::vector<std::vector<data_type> *> h_out_real,
+                     bool dump) {
+    clfft_caller<data_type> &source = *callers[0];
+    size_t nseg_all = source.segment_count(h_in);
+    size_t iteration = (nseg_all + source.seg_count - 1) / source.seg_count;
+    for (size_t i = 0; i < iteration; i++) {
+        source.load_batch(h_in, i, nseg_all);
+        for (size_t k = 0; k < callers.size(); k++) {
+            callers[k]->transform_batch(i, *h_out_complex[k], *h_out_real[k]);
+        }
+        if (dump && i == 0) {
+            source.dump_batch(i);
+        }
+
+        std::cout << "generate_timer: " << generate_timer.getTime() << "  "
+                  << "fft_timer: " << fft_timer.getTime() << "  "
+                  << "rfi_timer: " << rfi_timer.getTime() << "  "
+                  << "normalize_timer: " << normalize_timer.getTime() << "  "
+                  << "copy_timer: " << copy_timer.getTime()
+                  << "    \r";
+        std::cout.flush();
     }
-};
\ No newline at end of file
+}
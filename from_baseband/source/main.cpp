@@ -8,23 +8,59 @@
 #define BOOST_COMPUTE_DEBUG_KERNEL_COMPILATION
 #define HD_BENCHMARK
 
+#include <algorithm>
 #include <boost/compute/system.hpp>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <clFFT.h>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <thread>
 
 #include "benchmark.hpp"
+#include "checks.hpp"
+#ifdef HAVE_ZSTD
+#include "fbz.hpp"
+#endif
 #include "global_variable.hpp"
 #include "io.hpp"
 #include "kernel.hpp"
+#include "parallel.hpp"
 #include "types.h"
 
-Stopwatch setup_timer, generate_timer, fft_timer, normalize_timer, copy_timer, write_timer;
+Stopwatch setup_timer, generate_timer, fft_timer, rfi_timer, normalize_timer, detect_timer, copy_timer, write_timer, batch_timer, input_wait_timer;
 
 boost::program_options::variables_map vm;
 
+/** @brief one output: a resolution and band, all made from the same input */
+struct product {
+    size_t in_nsamp_seg, seg_count, out_nsamp_seg;
+    float df, fmin, fmax;
+    size_t fmin_id, fmax_id, out_part_nsamp_seg;
+    size_t zoom_center = 0, chan_offset = 0; // in zoom mode, fft output channel c is channel c + chan_offset of full band
+    size_t start_segment, file_seg_count, seg_count_all;
+    std::string out_cut_file_name;
+    std::vector<data_type> h_out_complex, h_out_real, h_out_part;
+    std::unique_ptr<positional_file> out_file; // channel-major output, written batch by batch
+#ifdef HAVE_ZSTD
+    std::unique_ptr<fbz::writer> compressed_file; // --compress output, fed batch by batch
+#endif
+    std::unique_ptr<clfft_caller<data_type>> fft_caller;
+};
+
+/** @brief one input file read into memory, ahead of its turn in batch mode */
+struct input_type {
+    std::string file_name;
+    std::vector<data_type> h_in;
+    size_t file_seg_count, seg_count_all;
+};
+
 int main(int argc, char **argv) {
     std::ios::sync_with_stdio(false);
 
@@ -32,28 +68,75 @@ int main(int argc, char **argv) {
     // Parse arguments & show help
     // ------------
     start_timer(setup_timer);
-    boost::program_options::options_description general_option("General Options"), fft_option("FFT Options"), all_option("Options");
+    boost::program_options::options_description general_option("General Options"), fft_option("FFT Options"), rfi_option("RFI Options"), gen_option("Generator Options"), all_option("Options");
     using boost::program_options::value;
     /* clang-format off */
     general_option.add_options()
         ("help,h", "Show help message")
         ("input_file,f,i", value<std::string>(), "Input file")
-        ("output_file,o", value<std::string>(), "Output file")
+        ("input_list", value<std::string>(), "Batch mode: transform every file listed in this file, one per line, keeping device set up between files. "
+                                             "Next file is read while one is transformed, so host memory holds input of 2 files besides output of one")
+        ("watch_dir", value<std::string>(), "Batch mode: transform files appearing in this directory, once their size stops changing; names starting with '.' are skipped. "
+                                            "Uses host memory as --input_list")
+        ("watch_interval", value<float>()->default_value(1.0f), "With --watch_dir, seconds between polls of the directory")
+        ("watch_timeout", value<float>()->default_value(0.0f), "With --watch_dir, exit after this many seconds without a new file, 0 to watch forever")
+        ("output_dir", value<std::string>(), "Batch mode: directory of output files, each named after its input file, with extension of --output_file (default .fil)")
+        ("output_file,o", value<std::vector<std::string>>()->composing(), "Output file, or one per --nsamp_seg by repeating this option")
         ("in_text", "Read input file as text")
         ("out_text", "Write output file as text")
-        ("inverse", "Transform padded filterbank to wave")
+        ("inverse", "Transform padded filterbank to wave, 2 * (nsamp_seg - 1) should then be a product of 2, 3, 5 and 7")
         ("no_flip", "Don't flip output data")
+        ("start_segment", value<size_t>()->default_value(0), "First segment of input file to process, for splitting a file across processes")
+        ("segment_count", value<size_t>()->default_value(0), "Number of segments to process, 0 to process till end of file")
+        ("dump_batch", "Write input and output of first batch as text files to current directory, for debugging")
+        ("shared_output", "Write output to its offset in output file instead of truncating it, so that processes of different segment ranges can share one output file")
+        ("channel_major", "Write output channel-major (one row per channel) instead of one spectrum per row, corner-turned on device")
+        ("channel_block", value<size_t>()->default_value(1), "With --channel_major, group this many channels into a stripe, each stripe is time-major inside")
+        ("compress", "Write output as bit-shuffled, compressed chunks with an index (.fbz), fbz2fil converts it back")
+        ("compress_chunk_nsamps", value<size_t>()->default_value(1024), "With --compress, number of output samples (spectra) per chunk")
+        ("compress_threads", value<size_t>()->default_value(0), "With --compress, number of compression threads, 0 to use all cores")
+        ("compress_level", value<int>()->default_value(1), "With --compress, zstd compression level")
     ;
     fft_option.add_options()
-        ("nsamp_seg", value<size_t>(), "Number of points to be FFT-ed in one segment")
-        ("seg_count", value<size_t>()->default_value(1), "Number of segments of points to be FFT-ed at one kernel call")
+        ("nsamp_seg", value<std::vector<size_t>>()->composing(), "Number of points to be FFT-ed in one segment, repeat this option to make several resolutions from one pass of input; "
+                                                                 "a length that isn't a product of 2, 3, 5 and 7 is transformed by the slower Bluestein algorithm, except with --inverse")
+        ("seg_count", value<size_t>()->default_value(1), "Number of segments of points to be FFT-ed at one kernel call, of the first --nsamp_seg; others should divide the batch")
         ("sample_rate", value<float>(), "Sample rate of input time series")
-        ("fmin", value<float>(), "Min of frequency of output channel, default to 0.0")
-        ("fmax", value<float>(), "Max of frequency of output channel, default to max frequency of the fft result")
-        ("pick_real_part", "Pick real part instead of normalize when converting complex nomber to real number")
+        ("fmin", value<std::vector<float>>()->composing(), "Min of frequency of output channel, default to 0.0; once or once per --nsamp_seg")
+        ("fmax", value<std::vector<float>>()->composing(), "Max of frequency of output channel, default to max frequency of the fft result; once or once per --nsamp_seg")
+        ("detect", value<std::string>()->default_value("amplitude"), "How to convert complex number to real number: power (|X|^2), amplitude (|X|) or real (real part); "
+                                                                     "Stokes parameters of --dual_pol are always power, so only power is accepted with it")
+        ("pick_real_part", "Pick real part instead of normalize when converting complex nomber to real number, same as --detect real")
+        ("dual_pol", "Input file contains two interleaved polarizations (x0 y0 x1 y1 ...), output Stokes I")
+        ("full_stokes", "With --dual_pol, output Stokes I, Q, U, V as 4 IFs")
+        ("work_group_size", value<size_t>()->default_value(256), "Max work-group size of detect kernels")
+        ("zoom", value<size_t>()->default_value(1), "Zoom into [fmin, fmax]: mix to baseband, low-pass filter and decimate by this factor on device, then do a complex fft of nsamp_seg / zoom points, 1 to disable. "
+                                                          "The filter delays output by zoom_taps * zoom / 2 input samples, see zoom_delay printed at start")
+        ("zoom_taps", value<size_t>()->default_value(32), "Taps of zoom low-pass filter per decimation factor, output is delayed by half of all taps")
+    ;
+    rfi_option.add_options()
+        ("rfi_sk_block", value<size_t>()->default_value(0), "Flag channels by spectral kurtosis of every this many segments, should divide seg_count, 0 to disable")
+        ("rfi_sk_threshold", value<float>()->default_value(3.0f), "Spectral kurtosis threshold, in sigma")
+        ("rfi_time_threshold", value<float>()->default_value(0.0f), "Flag segments whose total power is this many sigma away from batch mean, 0 to disable")
+        ("rfi_zero_dm", "Apply zero-DM filter to detected spectra")
+        ("rfi_mask_file", value<std::string>(), "Sidecar file to write channel and segment masks of each batch to, of the first --nsamp_seg only; not supported with --shared_output")
+    ;
+    gen_option.add_options()
+        ("generate", "Generate input on device instead of reading input file, --sample_rate, --fmin, --fmax and frequencies below are then in MHz")
+        ("gen_segments", value<size_t>(), "Number of segments to generate")
+        ("gen_seed", value<cl_uint>()->default_value(0), "Seed of random numbers")
+        ("gen_noise_sigma", value<float>()->default_value(1.0f), "Standard deviation of gaussian noise")
+        ("gen_tone_freq", value<std::vector<float>>()->multitoken(), "Frequencies of tones, in MHz of baseband")
+        ("gen_tone_amplitude", value<std::vector<float>>()->multitoken(), "Amplitudes of tones, default to 1")
+        ("gen_sky_freq", value<float>()->default_value(1000.0f), "Sky frequency of zero frequency of baseband, in MHz, used to disperse pulses")
+        ("gen_dm", value<float>()->default_value(0.0f), "Dispersion measure of pulses, in pc cm^-3")
+        ("gen_pulse_amplitude", value<float>()->default_value(0.0f), "Amplitude of pulses, 0 to disable pulses")
+        ("gen_pulse_width", value<float>()->default_value(1.0f), "Width of pulses, in ms")
+        ("gen_pulse_period", value<float>()->default_value(0.0f), "Period of pulses, in ms, 0 for a single pulse")
+        ("gen_pulse_time", value<float>()->default_value(0.0f), "Time (first) pulse passes top of band, in ms")
     ;
     /* clang-format on */
-    all_option.add(general_option).add(fft_option);
+    all_option.add(general_option).add(fft_option).add(rfi_option).add(gen_option);
     boost::program_options::positional_options_description p;
     p.add("input_file", 1);
     boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(all_option).positional(p).run(), vm);
@@ -62,9 +145,13 @@ int main(int argc, char **argv) {
     if (vm.count("help")) {
         std::cout << general_option << std::endl;
         std::cout << fft_option << std::endl;
+        std::cout << rfi_option << std::endl;
+        std::cout << gen_option << std::endl;
         return 0;
     }
-    if ((!vm.count("inverse")) && !(vm.count("nsamp_seg") && vm.count("input_file") && vm.count("sample_rate"))) {
+    bool generating = (vm.count("generate") != 0);
+    bool batch_mode = (vm.count("input_list") || vm.count("watch_dir"));
+    if ((!vm.count("inverse")) && !(vm.count("nsamp_seg") && (vm.count("input_file") || batch_mode || (generating && vm.count("gen_segments"))) && vm.count("sample_rate"))) {
         std::cout << general_option << std::endl;
         std::cout << fft_option << std::endl;
         return 1;
@@ -75,67 +162,308 @@ int main(int argc, char **argv) {
     // Read arguments and set up
     // ------------
     bool inverse = (vm.count("inverse") != 0);
-    size_t in_nsamp_seg = vm["nsamp_seg"].as<size_t>();
+    std::vector<size_t> nsamp_segs = vm["nsamp_seg"].as<std::vector<size_t>>();
     size_t seg_count = vm["seg_count"].as<size_t>();
-    size_t out_nsamp_seg;
-    if (!inverse) {
-        out_nsamp_seg = 1 + in_nsamp_seg / 2; // Note: count of complex numbers
-    } else {
-        out_nsamp_seg = 2 * (in_nsamp_seg - 1); // Note: count of real numbers, as here `in_nsamp_seg` is count of complex numbers
+    size_t npol = (vm.count("dual_pol") ? 2 : 1);
+    size_t nifs = ((npol == 2 && vm.count("full_stokes")) ? 4 : 1);
+    if (npol == 2 && ((!vm["detect"].defaulted() && vm["detect"].as<std::string>() != "power") || vm.count("pick_real_part"))) {
+        std::cerr << "Stokes parameters of --dual_pol are always detected as power, --detect " << vm["detect"].as<std::string>() << " or --pick_real_part is not supported" << std::endl;
+        return -1;
     }
     float sample_rate = vm["sample_rate"].as<float>();
-    float df = sample_rate / in_nsamp_seg;
-    float fmin = 0.0f;
+    std::vector<float> fmins, fmaxs;
     if (vm.count("fmin")) {
-        fmin = vm["fmin"].as<float>();
+        fmins = vm["fmin"].as<std::vector<float>>();
     }
-    float fmax;
     if (vm.count("fmax")) {
-        fmax = vm["fmax"].as<float>();
-    } else {
-        fmax = (in_nsamp_seg / 2) * df;
+        fmaxs = vm["fmax"].as<std::vector<float>>();
+    }
+    std::vector<std::string> out_file_names;
+    if (vm.count("output_file")) {
+        out_file_names = vm["output_file"].as<std::vector<std::string>>();
+    }
+    size_t product_count = nsamp_segs.size();
+    auto per_product = [&](size_t n) { return n == 0 || n == 1 || n == product_count; };
+    if (product_count == 0 || (inverse && product_count != 1) || !per_product(fmins.size()) || !per_product(fmaxs.size()) ||
+        !((batch_mode && out_file_names.empty()) || out_file_names.size() == 1 || out_file_names.size() == product_count)) {
+        std::cerr << "--fmin, --fmax and --output_file should be given once or once per --nsamp_seg, and --inverse only supports one --nsamp_seg" << std::endl;
+        return -1;
     }
-    size_t fmin_id = std::max(static_cast<size_t>(std::round(fmin / df)), static_cast<size_t>(0));
-    size_t fmax_id = std::min(static_cast<size_t>(std::round(fmax / df)), static_cast<size_t>(out_nsamp_seg - 1));
-    if (fmin_id > fmax_id) {
-        std::cerr << "fmin_id = " << fmin_id << "but max fmax_id = " << fmax_id << std::endl;
+    if (batch_mode && (vm.count("input_file") || !vm.count("output_dir") || generating || vm.count("in_text") || vm.count("shared_output") || vm.count("rfi_mask_file"))) {
+        std::cerr << "batch mode takes --input_list or --watch_dir instead of --input_file, needs --output_dir, "
+                  << "and doesn't support --generate, --in_text, --shared_output or --rfi_mask_file" << std::endl;
         return -1;
     }
-    size_t out_part_nsamp_seg = (fmax_id - fmin_id + 1);
+    std::error_code same_dir_error;
+    if (vm.count("watch_dir") && std::filesystem::equivalent(vm["watch_dir"].as<std::string>(), vm["output_dir"].as<std::string>(), same_dir_error)) {
+        std::cerr << "--output_dir should differ from --watch_dir, or outputs would be taken as inputs" << std::endl;
+        return -1;
+    }
+    size_t zoom = std::max(vm["zoom"].as<size_t>(), static_cast<size_t>(1));
 
-    std::string in_file_name = vm["input_file"].as<std::string>();
-    size_t in_file_nsamps;
-    std::vector<data_type> h_in;
-    if (vm.count("in_text")) {
-        std::ifstream in_file_stream(in_file_name);
-        // h_in = std::vector<data_type>(std::istream_iterator<data_type>(in_file_stream), {});
-        data_type tmp;
-        while (in_file_stream >> tmp) {
-            h_in.push_back(tmp);
-        }
-        in_file_nsamps = h_in.size();
-    } else {
-        FILE *in_file_stream;
-        in_file_stream = fopen(in_file_name.c_str(), "rb");
-        size_t in_file_length = std::filesystem::file_size(in_file_name);
-        in_file_nsamps = in_file_length / sizeof(data_type);
-        h_in.resize(in_file_nsamps);
-        fread(&h_in[0], 1, in_file_length, in_file_stream);
-        fclose(in_file_stream);
-    }
-    size_t seg_count_all = in_file_nsamps / in_nsamp_seg;
-    size_t out_file_nsamps = out_nsamp_seg * seg_count_all;
-    size_t out_part_file_nsamps = out_part_nsamp_seg * seg_count_all;
-    std::vector<data_type> h_out_complex(2 * out_file_nsamps), h_out_real(out_file_nsamps);
-    std::vector<data_type> h_out_part(out_part_file_nsamps);
-    std::string out_cut_file_name = vm["output_file"].as<std::string>();
+    // a batch is `seg_count` segments of the first resolution, the others should fit it exactly, so that they can share its input
+    size_t batch_nsamp = seg_count * nsamp_segs[0];
+    std::vector<product> products(product_count);
+    for (size_t k = 0; k < product_count; k++) {
+        product &prod = products[k];
+        prod.in_nsamp_seg = nsamp_segs[k];
+        if (batch_nsamp % prod.in_nsamp_seg != 0) {
+            std::cerr << "nsamp_seg = " << prod.in_nsamp_seg << " doesn't divide batch of " << batch_nsamp << " samples" << std::endl;
+            return -1;
+        }
+        prod.seg_count = batch_nsamp / prod.in_nsamp_seg;
+        if (!inverse) {
+            prod.out_nsamp_seg = 1 + prod.in_nsamp_seg / 2; // Note: count of complex numbers
+        } else {
+            prod.out_nsamp_seg = 2 * (prod.in_nsamp_seg - 1); // Note: count of real numbers, as here `in_nsamp_seg` is count of complex numbers
+            // Bluestein is only done for forward transforms
+            if (!check_fft_length(prod.out_nsamp_seg)) {
+                std::cerr << "--inverse needs 2 * (nsamp_seg - 1) = " << prod.out_nsamp_seg << " to be a product of 2, 3, 5 and 7" << std::endl;
+                return -1;
+            }
+        }
+        prod.df = sample_rate / prod.in_nsamp_seg;
+        prod.fmin = fmins.empty() ? 0.0f : fmins[std::min(k, fmins.size() - 1)];
+        prod.fmax = fmaxs.empty() ? (prod.in_nsamp_seg / 2) * prod.df : fmaxs[std::min(k, fmaxs.size() - 1)];
+        prod.fmin_id = std::max(static_cast<size_t>(std::round(prod.fmin / prod.df)), static_cast<size_t>(0));
+        prod.fmax_id = std::min(static_cast<size_t>(std::round(prod.fmax / prod.df)), static_cast<size_t>(prod.out_nsamp_seg - 1));
+        if (prod.fmin_id > prod.fmax_id) {
+            std::cerr << "fmin_id = " << prod.fmin_id << "but max fmax_id = " << prod.fmax_id << std::endl;
+            return -1;
+        }
+        prod.out_part_nsamp_seg = (prod.fmax_id - prod.fmin_id + 1);
+
+        if (zoom > 1) {
+            size_t zoom_nsamp_seg = prod.in_nsamp_seg / zoom;
+            if (inverse || prod.in_nsamp_seg % zoom != 0 || zoom_nsamp_seg % 2 != 0) {
+                std::cerr << "--zoom should divide nsamp_seg into an even length, and doesn't support --inverse" << std::endl;
+                return -1;
+            }
+            // the filter history is taken from the last segment of a batch
+            if (vm["zoom_taps"].as<size_t>() > zoom_nsamp_seg) {
+                std::cerr << "--zoom_taps should not exceed nsamp_seg / zoom = " << zoom_nsamp_seg << std::endl;
+                return -1;
+            }
+            prod.zoom_center = std::max((prod.fmin_id + prod.fmax_id + 1) / 2, zoom_nsamp_seg / 2);
+            prod.chan_offset = prod.zoom_center - zoom_nsamp_seg / 2;
+            // edges of output are in transition band of the low-pass filter
+            size_t margin = zoom_nsamp_seg / 10;
+            if (prod.fmin_id < prod.chan_offset + margin || prod.fmax_id + margin >= prod.chan_offset + zoom_nsamp_seg) {
+                std::cerr << "[fmin, fmax] is too wide for --zoom " << zoom << ", use a smaller one" << std::endl;
+                return -1;
+            }
+            prod.out_nsamp_seg = zoom_nsamp_seg;
+        }
+
+    }
+
+    // only segments [start_segment, start_segment + seg_count_all) of each file are read, counted in the first resolution
+    size_t in_nsamp_seg = nsamp_segs[0];
+    size_t in_seg_nsamps = npol * in_nsamp_seg; // samples of all polarizations in a segment
+    size_t start_segment = vm["start_segment"].as<size_t>();
+    size_t segment_count = vm["segment_count"].as<size_t>();
+    if (generating && inverse) {
+        std::cerr << "--generate doesn't support --inverse" << std::endl;
+        return -1;
+    }
+    bool shared_output = (vm.count("shared_output") != 0);
+    if (shared_output && (vm.count("out_text") || vm.count("rfi_mask_file"))) {
+        // each process would truncate the mask file and write its masks from the start
+        std::cerr << "--shared_output doesn't support --out_text or --rfi_mask_file" << std::endl;
+        return -1;
+    }
+    bool compress = (vm.count("compress") != 0);
+#ifndef HAVE_ZSTD
+    if (compress) {
+        std::cerr << "--compress is not available, built without zstd" << std::endl;
+        return -1;
+    }
+#endif
+    if (compress && (inverse || shared_output || vm.count("out_text") || vm.count("channel_major"))) {
+        std::cerr << "--compress only supports binary time-major filterbank output, without --shared_output" << std::endl;
+        return -1;
+    }
+    bool channel_major = (!inverse && vm.count("channel_major"));
+    size_t channel_block = std::max(vm["channel_block"].as<size_t>(), static_cast<size_t>(1));
+    if (channel_major && (nifs != 1 || vm.count("out_text"))) {
+        std::cerr << "--channel_major doesn't support --full_stokes or --out_text" << std::endl;
+        return -1;
+    }
+    for (product &prod : products) {
+        // segments of this resolution in the samples of whole segments of the first one
+        prod.start_segment = start_segment * in_nsamp_seg / prod.in_nsamp_seg;
+        if (shared_output && (start_segment * in_nsamp_seg) % prod.in_nsamp_seg != 0) {
+            std::cerr << "--start_segment of --shared_output should be at a segment boundary of every nsamp_seg" << std::endl;
+            return -1;
+        }
+    }
+
+    // ------------
+    // Input files: --input_file, files listed in --input_list, or files appearing in --watch_dir
+    // ------------
+    std::ifstream input_list_stream;
+    if (vm.count("input_list")) {
+        input_list_stream.open(vm["input_list"].as<std::string>());
+        if (!input_list_stream) {
+            std::cerr << "Cannot open input list " << vm["input_list"].as<std::string>() << std::endl;
+            return -1;
+        }
+    }
+    bool single_taken = false;
+    std::set<std::string> watch_taken;
+    std::map<std::string, uintmax_t> watch_size; // size at last poll of files not taken yet
+    auto next_input_name = [&]() -> std::optional<std::string> {
+        if (vm.count("input_list")) {
+            std::string line;
+            while (std::getline(input_list_stream, line)) {
+                if (!line.empty() && line[0] != '#') {
+                    return line;
+                }
+            }
+            return std::nullopt;
+        }
+        if (vm.count("watch_dir")) {
+            // a file is taken once its size stays the same for one poll, so that files being copied in are not read
+            auto idle_begin = std::chrono::steady_clock::now();
+            float watch_timeout = vm["watch_timeout"].as<float>();
+            while (true) {
+                std::vector<std::string> ready;
+                std::error_code ec;
+                for (const auto &entry : std::filesystem::directory_iterator(vm["watch_dir"].as<std::string>(), ec)) {
+                    std::string name = entry.path().string();
+                    if (!entry.is_regular_file(ec) || entry.path().filename().string()[0] == '.' || watch_taken.count(name)) {
+                        continue;
+                    }
+                    uintmax_t size = entry.file_size(ec);
+                    if (ec) {
+                        continue;
+                    }
+                    auto it = watch_size.find(name);
+                    if (it != watch_size.end() && it->second == size) {
+                        ready.push_back(name);
+                    } else {
+                        watch_size[name] = size;
+                    }
+                }
+                if (!ready.empty()) {
+                    std::string name = *std::min_element(ready.begin(), ready.end());
+                    watch_taken.insert(name);
+                    watch_size.erase(name);
+                    return name;
+                }
+                if (watch_timeout > 0 && std::chrono::duration<float>(std::chrono::steady_clock::now() - idle_begin).count() > watch_timeout) {
+                    return std::nullopt;
+                }
+                std::this_thread::sleep_for(std::chrono::duration<float>(vm["watch_interval"].as<float>()));
+            }
+        }
+        if (single_taken) {
+            return std::nullopt;
+        }
+        single_taken = true;
+        return generating ? std::string("(generated)") : vm["input_file"].as<std::string>();
+    };
+
+    auto read_input = [&](const std::string &in_file_name) {
+        input_type input;
+        input.file_name = in_file_name;
+        std::vector<data_type> &h_in = input.h_in;
+        auto segments_to_read = [&]() { return std::min(input.file_seg_count - std::min(start_segment, input.file_seg_count), segment_count ? segment_count : input.file_seg_count); };
+        if (generating) {
+            input.file_seg_count = vm["gen_segments"].as<size_t>();
+            input.seg_count_all = segments_to_read();
+        } else if (vm.count("in_text")) {
+            std::ifstream in_file_stream(in_file_name);
+            // h_in = std::vector<data_type>(std::istream_iterator<data_type>(in_file_stream), {});
+            data_type tmp;
+            while (in_file_stream >> tmp) {
+                h_in.push_back(tmp);
+            }
+            input.file_seg_count = h_in.size() / in_seg_nsamps;
+            input.seg_count_all = segments_to_read();
+            h_in.erase(h_in.begin(), h_in.begin() + std::min(start_segment * in_seg_nsamps, h_in.size()));
+            h_in.resize(input.seg_count_all * in_seg_nsamps);
+        } else {
+            FILE *in_file_stream;
+            in_file_stream = fopen(in_file_name.c_str(), "rb");
+            if (in_file_stream == nullptr) {
+                throw std::runtime_error("Cannot open input file " + in_file_name);
+            }
+            size_t in_file_length = std::filesystem::file_size(in_file_name);
+            input.file_seg_count = in_file_length / sizeof(data_type) / in_seg_nsamps;
+            input.seg_count_all = segments_to_read();
+            h_in.resize(input.seg_count_all * in_seg_nsamps);
+            fseeko(in_file_stream, start_segment * in_seg_nsamps * sizeof(data_type), SEEK_SET);
+            size_t read_count = fread(h_in.data(), sizeof(data_type), h_in.size(), in_file_stream);
+            fclose(in_file_stream);
+            if (read_count != h_in.size()) {
+                throw std::runtime_error("Short read of input file " + in_file_name);
+            }
+        }
+        return input;
+    };
+
+    // in batch mode, read next file on another thread while this one is transformed
+    auto fetch_input = [&]() {
+        return std::async(std::launch::async, [&]() -> std::optional<input_type> {
+            std::optional<std::string> in_file_name = next_input_name();
+            if (!in_file_name) {
+                return std::nullopt;
+            }
+            return read_input(*in_file_name);
+        });
+    };
+    // first input is read while device is set up
+    std::future<std::optional<input_type>> next_input = fetch_input();
+
+    // one output name for several resolutions, e.g. out.fil -> out_1024.fil, out_4096.fil
+    auto set_output_names = [&](const std::vector<std::string> &names) {
+        for (size_t k = 0; k < product_count; k++) {
+            product &prod = products[k];
+            if (names.size() == product_count) {
+                prod.out_cut_file_name = names[k];
+            } else {
+                std::filesystem::path path(names[0]);
+                prod.out_cut_file_name = (path.parent_path() / (path.stem().string() + "_" + std::to_string(prod.in_nsamp_seg) + path.extension().string())).string();
+            }
+        }
+    };
+    // in batch mode, output of in_dir/name.dat is output_dir/name.fil;
+    // inputs of the same stem (a/x.dat & b/x.dat, or x.dat & x.raw) get x.fil, x_2.fil, ... instead of overwriting each other
+    std::set<std::string> batch_output_used;
+    auto batch_output_names = [&](const std::string &in_file_name) {
+        std::string extension = out_file_names.empty() ? std::string(".fil") : std::filesystem::path(out_file_names[0]).extension().string();
+        std::filesystem::path output_dir(vm["output_dir"].as<std::string>());
+        std::string stem = std::filesystem::path(in_file_name).stem().string();
+        std::string out_name = (output_dir / (stem + extension)).string();
+        for (size_t k = 2; batch_output_used.count(out_name); k++) {
+            out_name = (output_dir / (stem + "_" + std::to_string(k) + extension)).string();
+        }
+        if (out_name != (output_dir / (stem + extension)).string()) {
+            std::cerr << "[WARNING] output of " << in_file_name << " is renamed to " << out_name << ", as an earlier input has the same name" << std::endl;
+        }
+        batch_output_used.insert(out_name);
+        return std::vector<std::string>{out_name};
+    };
 
     // Set up device side
     namespace bc = boost::compute;
     bc::command_queue queue = bc::system::default_queue();
     bc::context context = queue.get_context();
     bc::device device = queue.get_device();
-    clfft_caller<data_type> fft_caller(queue, in_nsamp_seg, seg_count, out_nsamp_seg, inverse);
+    for (size_t k = 0; k < product_count; k++) {
+        product &prod = products[k];
+        prod.fft_caller = std::make_unique<clfft_caller<data_type>>(queue, prod.in_nsamp_seg, prod.seg_count, prod.out_nsamp_seg, inverse, npol, nifs, zoom, prod.zoom_center);
+        if (k > 0) {
+            prod.fft_caller->share_input(*products[0].fft_caller);
+        }
+        if (!inverse) {
+            prod.fft_caller->set_output_band(prod.fmin_id - prod.chan_offset, prod.out_part_nsamp_seg);
+        }
+        if (channel_major) {
+            prod.fft_caller->set_channel_major_output(prod.fmin_id - prod.chan_offset, prod.out_part_nsamp_seg, !vm.count("no_flip"), channel_block);
+        }
+    }
     // ------------
     stop_timer(setup_timer);
     std::cout << "setup_timer: " << setup_timer.getTime() << std::endl;
@@ -144,76 +472,222 @@ int main(int argc, char **argv) {
     // Print info
     // ------------
     /* clang-format off */
-    std::cout << "in_nsamp_seg = " << in_nsamp_seg << ", " << "out_nsamp_seg = " << out_nsamp_seg << std::endl
-              << "seg_count = " << seg_count << std::endl
-              << "in_file_name = " << in_file_name << ", " << "out_cut_file_name = " << out_cut_file_name << std::endl
-              << "in_file_nsamps = " << in_file_nsamps << std::endl
-              << "fmin = " << fmin << "  " << "fmax = " << fmax << "  " << "df = " << df << std::endl
-              << "fmin_id = " << fmin_id << "  " << "fmax_id = " << fmax_id << std::endl;
+    std::cout << "seg_count = " << seg_count << ", " << "npol = " << npol << ", " << "nifs = " << nifs << std::endl;
+    for (const product &prod : products) {
+        std::cout << "in_nsamp_seg = " << prod.in_nsamp_seg << ", " << "out_nsamp_seg = " << prod.out_nsamp_seg << ", " << "seg_count = " << prod.seg_count << std::endl
+                  << "    fmin = " << prod.fmin << "  " << "fmax = " << prod.fmax << "  " << "df = " << prod.df << std::endl
+                  << "    fmin_id = " << prod.fmin_id << "  " << "fmax_id = " << prod.fmax_id << "  " << "zoom = " << zoom << "  " << "zoom_center = " << prod.zoom_center << std::endl;
+    }
+    if (zoom > 1) {
+        // group delay of the linear-phase FIR; not compensated, as that needs samples of next batch
+        size_t zoom_delay = vm["zoom_taps"].as<size_t>() * zoom / 2;
+        std::cout << "zoom_delay = " << zoom_delay << " input samples = " << zoom_delay / sample_rate << " / (unit of --sample_rate), "
+                  << "spectrum of segment s covers input samples [s * nsamp_seg - zoom_delay, (s + 1) * nsamp_seg - zoom_delay)" << std::endl;
+    }
     /* clang-format on */
 
     std::cout << "Using device " << device.name() << " on platform " << device.platform().name() << std::endl;
     // ------------
 
-    /*
-    // ------------
-    start_timer(generate_timer);
-    fft_caller.generate();
-    stop_timer(generate_timer);
-    std::cout << "generate_timer: " << generate_timer.getTime() << std::endl;
-    // ------------
-*/
-
-    // ------------
-    // Do fft
-    // ------------
-    fft_caller.call_fft(h_in, h_out_complex, h_out_real);
-    std::cout << "\nfft_timer (average): " << fft_timer.getAverageTime() << " ms" << std::endl;
-    // ------------
-
-    fft_caller.teardown();
+    // each batch is read once and transformed at every resolution
+    std::vector<clfft_caller<data_type> *> callers;
+    std::vector<std::vector<data_type> *> h_out_complexes, h_out_reals;
+    for (product &prod : products) {
+        callers.push_back(prod.fft_caller.get());
+        h_out_complexes.push_back(&prod.h_out_complex);
+        h_out_reals.push_back(&prod.h_out_real);
+    }
 
-    if (!inverse) {
-        start_timer(copy_timer);
+    // sigproc layout: each output sample is `nifs` IFs of `out_part_nsamp_seg` channels, cut from `nspectra` samples of `nifs` spectra of fft output
+    auto cut_spectra = [&](const product &prod, const data_type *spectra, size_t nspectra, data_type *part) {
+        size_t out_nsamp_seg = prod.out_nsamp_seg, out_part_nsamp_seg = prod.out_part_nsamp_seg;
+        size_t fmin_id = prod.fmin_id - prod.chan_offset, fmax_id = prod.fmax_id - prod.chan_offset; // channels of fft output
         if (!vm.count("no_flip")) {
-            for (size_t i = 0; i < seg_count_all; i++) {
+            for (size_t i = 0; i < nspectra * nifs; i++) {
                 for (size_t j = 0; j < out_part_nsamp_seg; j++) {
-                    size_t h_out_part_idx = out_part_nsamp_seg * i + j;
-                    size_t h_out_real_idx = out_nsamp_seg * i + (fmax_id - j);
-                    assert(h_out_part_idx < h_out_part.size());
-                    assert(h_out_real_idx < h_out_real.size());
-                    h_out_part[h_out_part_idx] = h_out_real[h_out_real_idx];
+                    part[out_part_nsamp_seg * i + j] = spectra[out_nsamp_seg * i + (fmax_id - j)];
                 }
-                // write_vector(h_out_part, out_part_nsamp_seg, seg_count_all, std::string("fil-test-part") + std::to_string(i) + ".txt");
             }
         } else {
-            for (size_t i = 0; i < seg_count_all; i++) {
-                size_t h_out_part_idx = out_part_nsamp_seg * i;
-                size_t h_out_real_idx = out_nsamp_seg * i + fmin_id;
-                assert(h_out_part_idx + out_part_nsamp_seg <= h_out_part.size());
-                assert(h_out_real_idx - fmin_id + out_nsamp_seg <= h_out_real.size());
-                bc::copy(h_out_real.begin() + h_out_real_idx, h_out_real.begin() + h_out_real_idx + out_part_nsamp_seg, h_out_part.begin() + h_out_part_idx);
-                // write_vector(h_out_part, out_part_nsamp_seg, seg_count_all, std::string("fil-test-part") + std::to_string(i) + ".txt");
+            for (size_t i = 0; i < nspectra * nifs; i++) {
+                std::copy(spectra + out_nsamp_seg * i + fmin_id, spectra + out_nsamp_seg * i + fmin_id + out_part_nsamp_seg, part + out_part_nsamp_seg * i);
+            }
+        }
+    };
+
+    size_t file_count = 0, total_in_nsamps = 0;
+    start_timer(batch_timer);
+    while (true) {
+        start_timer(input_wait_timer);
+        std::optional<input_type> next;
+        try {
+            next = next_input.get();
+        } catch (const std::exception &e) {
+            if (!batch_mode) {
+                throw;
             }
+            // a bad file doesn't stop the batch
+            stop_timer(input_wait_timer);
+            std::cerr << "[ERROR] " << e.what() << ", skipped" << std::endl;
+            next_input = fetch_input();
+            continue;
         }
-        stop_timer(copy_timer);
+        stop_timer(input_wait_timer);
+        if (!next) {
+            break;
+        }
+        input_type input = std::move(*next);
+        next_input = fetch_input();
+        std::vector<data_type> &h_in = input.h_in;
+        size_t file_seg_count = input.file_seg_count, seg_count_all = input.seg_count_all;
+        size_t in_file_nsamps = seg_count_all * in_seg_nsamps;
+        set_output_names(batch_mode ? batch_output_names(input.file_name) : out_file_names);
+
+        for (product &prod : products) {
+            prod.file_seg_count = file_seg_count * in_nsamp_seg / prod.in_nsamp_seg;
+            prod.seg_count_all = seg_count_all * in_nsamp_seg / prod.in_nsamp_seg;
+            size_t out_file_nsamps = prod.out_nsamp_seg * prod.seg_count_all;
+            // channel-major output is cut, flipped and corner-turned on device, and written batch by batch, so nothing of it is kept on host;
+            // compressed output is cut and fed to the writer batch by batch, so only a batch of it is kept
+            bool streamed = (channel_major || compress);
+            prod.h_out_complex.resize(streamed ? 0 : 2 * npol * out_file_nsamps);
+            prod.h_out_real.resize(streamed ? 0 : nifs * out_file_nsamps);
+            prod.h_out_part.resize(channel_major ? 0 : nifs * prod.out_part_nsamp_seg * (compress ? prod.seg_count : prod.seg_count_all));
+#ifdef HAVE_ZSTD
+            if (compress) {
+                size_t compress_threads = vm["compress_threads"].as<size_t>();
+                prod.compressed_file = std::make_unique<fbz::writer>(prod.out_cut_file_name, "", sizeof(data_type), nifs * prod.out_part_nsamp_seg * sizeof(data_type),
+                                                                     vm["compress_chunk_nsamps"].as<size_t>(), compress_threads ? compress_threads : default_thread_count(),
+                                                                     vm["compress_level"].as<int>());
+                prod.fft_caller->set_output_sink([&prod, &cut_spectra](size_t, size_t nseg_valid, const std::vector<data_type> &spectra) {
+                    start_timer(write_timer);
+                    cut_spectra(prod, spectra.data(), nseg_valid, prod.h_out_part.data());
+                    prod.compressed_file->write(prod.h_out_part.data(), nseg_valid);
+                    stop_timer(write_timer);
+                });
+            }
+#endif
+            if (channel_major) {
+                // stripes in a shared file hold all segments of the input file, otherwise those read by this process
+                size_t stripe_seg_count = shared_output ? prod.file_seg_count : prod.seg_count_all;
+                size_t seg_begin = shared_output ? prod.start_segment : 0;
+                prod.out_file = std::make_unique<positional_file>(prod.out_cut_file_name, !shared_output);
+                prod.fft_caller->set_output_sink([&prod, channel_block, stripe_seg_count, seg_begin](size_t batch_index, size_t nseg_valid, const std::vector<data_type> &stripes) {
+                    start_timer(write_timer);
+                    size_t seg_offset = seg_begin + batch_index * prod.seg_count;
+                    for (size_t stripe_offset = 0; stripe_offset < prod.out_part_nsamp_seg; stripe_offset += channel_block) {
+                        size_t width = std::min(channel_block, prod.out_part_nsamp_seg - stripe_offset);
+                        prod.out_file->write_at(stripes.data() + stripe_offset * prod.seg_count, width * nseg_valid * sizeof(data_type),
+                                                (stripe_offset * stripe_seg_count + seg_offset * width) * sizeof(data_type));
+                    }
+                    stop_timer(write_timer);
+                });
+            }
+        }
+        if (generating) {
+            products[0].fft_caller->set_generator(seg_count_all, start_segment, sample_rate);
+        }
+
+        /* clang-format off */
+        std::cout << "in_file_name = " << input.file_name << std::endl
+                  << "in_file_nsamps = " << in_file_nsamps << ", " << "start_segment = " << start_segment << ", " << "seg_count_all = " << seg_count_all << " of " << file_seg_count << std::endl;
+        for (const product &prod : products) {
+            std::cout << "    out_cut_file_name = " << prod.out_cut_file_name << std::endl;
+        }
+        /* clang-format on */
 
         // ------------
-        start_timer(write_timer);
-        if (vm.count("out_text")) {
-            write_vector(h_out_part, out_part_nsamp_seg, seg_count_all, out_cut_file_name);
-        } else {
-            write_vector_binary(h_out_part, out_part_nsamp_seg * seg_count_all, out_cut_file_name);
+        // Do fft
+        // ------------
+        // zoom filter history of previous file mustn't leak into this one
+        for (clfft_caller<data_type> *caller : callers) {
+            caller->reset_stream();
         }
-        stop_timer(write_timer);
-    } else {
-        start_timer(write_timer);
-        if (vm.count("out_text")) {
-            write_vector(h_out_real, out_nsamp_seg, seg_count_all, out_cut_file_name);
-        } else {
-            write_vector_binary(h_out_real, out_nsamp_seg * seg_count_all, out_cut_file_name);
+        // debug dump is off by default, as shards of --shared_output would overwrite each other's dumps in the same directory;
+        // in batch mode it is of first file only
+        call_fft_shared(callers, h_in, h_out_complexes, h_out_reals, vm.count("dump_batch") && file_count == 0);
+        std::cout << std::endl;
+        // ------------
+
+        for (product &prod : products) {
+            std::vector<data_type> &h_out_real = prod.h_out_real, &h_out_part = prod.h_out_part;
+            const std::string &out_cut_file_name = prod.out_cut_file_name;
+            size_t out_nsamp_seg = prod.out_nsamp_seg, out_part_nsamp_seg = prod.out_part_nsamp_seg, seg_count_all = prod.seg_count_all;
+
+            if (channel_major) {
+                // already written by the sink
+                prod.out_file.reset();
+            } else if (compress) {
+#ifdef HAVE_ZSTD
+                // already fed to the writer batch by batch, only last chunk and index are left
+                start_timer(write_timer);
+                prod.compressed_file->close();
+                prod.compressed_file.reset();
+                stop_timer(write_timer);
+#endif
+            } else if (!inverse) {
+                start_timer(copy_timer);
+                cut_spectra(prod, h_out_real.data(), seg_count_all, h_out_part.data());
+                stop_timer(copy_timer);
+
+                // ------------
+                start_timer(write_timer);
+                if (vm.count("out_text")) {
+                    write_vector(h_out_part, nifs * out_part_nsamp_seg, seg_count_all, out_cut_file_name);
+                } else if (shared_output) {
+                    write_vector_binary_at(h_out_part, 0, nifs * out_part_nsamp_seg * seg_count_all, out_cut_file_name, prod.start_segment * nifs * out_part_nsamp_seg * sizeof(data_type));
+                } else {
+                    write_vector_binary(h_out_part, nifs * out_part_nsamp_seg * seg_count_all, out_cut_file_name);
+                }
+                stop_timer(write_timer);
+            } else {
+                start_timer(write_timer);
+                if (vm.count("out_text")) {
+                    write_vector(h_out_real, out_nsamp_seg, seg_count_all, out_cut_file_name);
+                } else if (shared_output) {
+                    write_vector_binary_at(h_out_real, 0, out_nsamp_seg * seg_count_all, out_cut_file_name, prod.start_segment * out_nsamp_seg * sizeof(data_type));
+                } else {
+                    write_vector_binary(h_out_real, out_nsamp_seg * seg_count_all, out_cut_file_name);
+                }
+                stop_timer(write_timer);
+            }
+        }
+        file_count++;
+        total_in_nsamps += in_file_nsamps;
+    }
+    stop_timer(batch_timer);
+
+    std::cout << "fft_timer (average): " << fft_timer.getAverageTime() << " ms" << std::endl;
+    size_t fft_nsamps = 0;
+    for (const product &prod : products) {
+        fft_nsamps += prod.fft_caller->fft_nsamps;
+        if (prod.fft_caller->bluestein_length) {
+            // Bluestein costs two ffts of bluestein_length, compare with a run of a fast --nsamp_seg
+            std::cout << "fft of length " << prod.fft_caller->fft_length << " is done by Bluestein of length " << prod.fft_caller->bluestein_length << std::endl;
         }
-        stop_timer(write_timer);
+    }
+    std::cout << "fft throughput: " << fft_nsamps / fft_timer.getTime() / 1e6 << " M samples/s" << std::endl;
+    if (!inverse) {
+        // detection only streams spectra through, so this should be close to memory bandwidth of the device
+        size_t detect_bytes = 0;
+        for (const product &prod : products) {
+            detect_bytes += prod.fft_caller->detect_bytes;
+        }
+        std::cout << "detect_timer: " << detect_timer.getTime() << ", " << "detect throughput: " << detect_bytes / detect_timer.getTime() / 1e9 << " GB/s" << std::endl;
+    }
+    if (generating) {
+        std::cout << "generate_timer (average): " << generate_timer.getAverageTime() << " ms" << std::endl;
+    }
+    if (batch_mode) {
+        // time waiting for input is reading not hidden behind transform of the previous file
+        std::cout << "files: " << file_count << ", " << "samples: " << total_in_nsamps << ", " << "batch_timer: " << batch_timer.getTime() << ", " << "input_wait_timer: " << input_wait_timer.getTime()
+                  << std::endl
+                  << "aggregate throughput: " << total_in_nsamps / batch_timer.getTime() / 1e6 << " M samples/s, " << total_in_nsamps * sizeof(data_type) / batch_timer.getTime() / 1e6 << " MB/s"
+                  << std::endl;
+    }
+
+    for (size_t k = product_count; k-- > 0;) {
+        products[k].fft_caller->teardown(k == 0);
     }
 
     start_timer(write_timer);
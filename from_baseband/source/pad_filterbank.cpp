@@ -14,6 +14,7 @@
 #include <iostream>
 #include <numeric>
 
+#include "filterbank_file.hpp"
 #include "io.hpp"
 #include "types.h"
 
@@ -84,28 +85,26 @@ int main(int argc, char **argv) {
     std::cout << "out_df = " << out_df << std::endl
               << "out_seg_length = " << out_seg_length << std::endl;
 
-    std::vector<data_type> h_in;
+    // binary input is memory-mapped instead of loaded, text input is parsed into `h_in_text`
+    std::vector<data_type> h_in_text;
+    mapped_file in_file;
+    const data_type *h_in;
     std::string in_file_name = vm["input_file"].as<std::string>();
     std::string out_file_name = vm["output_file"].as<std::string>();
     size_t in_file_nsamps;
     if (vm.count("in_text")) {
         std::ifstream in_file_stream(in_file_name);
-        // h_in = std::vector<data_type>(std::istream_iterator<data_type>(in_file_stream), {});
         data_type tmp;
         while (in_file_stream >> tmp) {
-            h_in.push_back(tmp);
+            h_in_text.push_back(tmp);
         }
-        in_file_nsamps = h_in.size();
+        h_in = h_in_text.data();
+        in_file_nsamps = h_in_text.size();
     } else {
-        FILE *in_file_stream;
-        in_file_stream = fopen(in_file_name.c_str(), "rb");
-        size_t in_file_length = std::filesystem::file_size(in_file_name);
-        in_file_nsamps = in_file_length / sizeof(data_type);
-        h_in.resize(in_file_nsamps);
-        fread(&h_in[0], 1, in_file_length, in_file_stream);
-        fclose(in_file_stream);
+        in_file = mapped_file(in_file_name);
+        h_in = reinterpret_cast<const data_type *>(in_file.data);
+        in_file_nsamps = in_file.size / sizeof(data_type);
     }
-    write_vector(h_in, "pad_fil-h_in.txt");
 
     std::vector<data_type> h_out_real; // output is padded filterbank
     std::fill(h_out_real.begin(), h_out_real.end(), pad_value_real);
@@ -118,12 +117,12 @@ int main(int argc, char **argv) {
             size_t f_current_idx = static_cast<size_t>(std::round(f_current / out_df));
             assert(f_current_idx < out_seg_length);
             size_t out_idx = out_seg_length * s + f_current_idx;
-            if (in_idx < h_in.size() && out_idx < h_out_real.size()) {
+            if (in_idx < in_file_nsamps && out_idx < h_out_real.size()) {
                 h_out_real[out_idx] = h_in[in_idx];
             } else {
                 std::cout << "Warning: "
                           << "in_idx = " << in_idx << ", "
-                          << "h_in.size() = " << h_in.size() << ", "
+                          << "in_file_nsamps = " << in_file_nsamps << ", "
                           << "out_idx = " << out_idx << ", "
                           << "h_out_real.size() = " << h_out_real.size() << std::endl;
             }
@@ -0,0 +1,52 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+#pragma once
+#ifndef _PARALLEL_HPP
+#define _PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/** @brief default thread count, 0 in options means this */
+inline size_t default_thread_count() {
+    return std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+}
+
+/**
+ * @brief call `f(i)` for i in [0, n) using `thread_count` threads, items are taken one by one
+ *        so uneven items are balanced. returns after all items are done.
+ */
+template <typename F>
+inline void parallel_for(size_t n, size_t thread_count, F f) {
+    thread_count = std::min(std::max(thread_count, static_cast<size_t>(1)), n);
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < n; i++) {
+            f(i);
+        }
+        return;
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            f(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+#endif // _PARALLEL_HPP
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+# Usage: ./shard.py --workers N [--dry_run] -- <arguments of filterbank-generation-test>
+#        splits input file into N segment ranges and runs one filterbank-generation-test for each,
+#        all writing to their offsets in the same output file (--shared_output).
+#        with --dry_run, commands are printed instead, e.g. to be run on other nodes sharing the file system.
+
+import argparse
+import os
+import shlex
+import subprocess
+import sys
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Split one input file across several filterbank-generation-test processes")
+    parser.add_argument("--workers", type=int, help="number of processes", default=os.cpu_count())
+    parser.add_argument("--exe", type=str, help="path of filterbank-generation-test", default="./filterbank-generation-test")
+    parser.add_argument("--dry_run", help="print commands instead of running them", action="store_true")
+    parser.add_argument("args", nargs=argparse.REMAINDER, help="arguments passed to each process, after `--`")
+    args = parser.parse_args()
+    worker_args = args.args[1:] if args.args[:1] == ["--"] else args.args
+
+    # the few arguments needed to count segments, the rest are passed through
+    sub_parser = argparse.ArgumentParser(add_help=False)
+    sub_parser.add_argument("--input_file", "-f", "-i", type=str)
+    sub_parser.add_argument("--output_file", "-o", type=str, action="append", required=True)
+    sub_parser.add_argument("--nsamp_seg", type=int, action="append", required=True)
+    sub_parser.add_argument("--seg_count", type=int, default=1)
+    sub_parser.add_argument("--dual_pol", action="store_true")
+    sub_parser.add_argument("input", nargs="?")
+    known, _ = sub_parser.parse_known_args(worker_args)
+    input_file = known.input_file or known.input
+    if input_file is None:
+        parser.error("input file is required")
+    if "--in_text" in worker_args or "--out_text" in worker_args:
+        parser.error("text input or output can't be split")
+
+    # data_type is float, see types.h; input is read in segments of the first resolution
+    npol = 2 if known.dual_pol else 1
+    total_segments = os.path.getsize(input_file) // (4 * npol * known.nsamp_seg[0])
+    # shard boundaries are aligned to batches, so only the last shard has a ragged batch
+    total_batches = (total_segments + known.seg_count - 1) // known.seg_count
+    workers = max(1, min(args.workers, total_batches))
+    print(f"[INFO] {total_segments} segments in {total_batches} batches, using {workers} workers")
+
+    # create (or truncate) output files here once, as workers write their parts without truncating,
+    # one name for several resolutions is expanded as in filterbank-generation-test
+    output_files = known.output_file
+    if len(output_files) == 1 and len(known.nsamp_seg) > 1:
+        stem, ext = os.path.splitext(output_files[0])
+        output_files = [f"{stem}_{n}{ext}" for n in known.nsamp_seg]
+    for output_file in output_files:
+        open(output_file, "wb").close()
+
+    commands = []
+    for w in range(workers):
+        begin = total_batches * w // workers * known.seg_count
+        end = min(total_batches * (w + 1) // workers * known.seg_count, total_segments)
+        commands.append([args.exe] + worker_args + ["--start_segment", str(begin), "--segment_count", str(end - begin), "--shared_output"])
+
+    if args.dry_run:
+        for command in commands:
+            print(" ".join(shlex.quote(c) for c in command))
+        return 0
+
+    processes = [subprocess.Popen(command, stdout=subprocess.DEVNULL) for command in commands]
+    ret = 0
+    for w, process in enumerate(processes):
+        if process.wait() != 0:
+            print(f"[ERROR] worker {w} exited with {process.returncode}", file=sys.stderr)
+            ret = 1
+    return ret
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,219 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// sigproc filterbank / time series header, ref: sigproc/filterbank_header.c, sigproc/read_header.c
+
+#pragma once
+#ifndef _SIGPROC_HPP
+#define _SIGPROC_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace sigproc {
+
+struct header {
+    int32_t telescope_id = 0, machine_id = 0;
+    int32_t data_type = 1; // filterbank data = 1, time series = 2
+    std::string rawdatafile, source_name;
+    int32_t barycentric = 0, pulsarcentric = 0;
+    double az_start = 0.0, za_start = 0.0, src_raj = 0.0, src_dej = 0.0;
+    double tstart = 0.0, tsamp = 0.0;
+    int32_t nbits = 32;
+    int32_t nsamples = 0;
+    double fch1 = 0.0, foff = 0.0;
+    int32_t nchans = 1, nifs = 1, nbeams = 1, ibeam = 0;
+    double refdm = 0.0, period = 0.0;
+    int32_t nbins = 0;
+    char signed_ = 0;
+
+    size_t header_size = 0; // length of header in bytes, set when read
+
+    /** @brief bytes of one sample, i.e. all channels of all IFs */
+    size_t bytes_per_sample() const {
+        return static_cast<size_t>(nifs) * nchans * nbits / 8;
+    }
+
+    /** @brief frequency of channel `c`, in MHz */
+    double channel_frequency(size_t c) const {
+        return fch1 + foff * c;
+    }
+};
+
+namespace detail {
+
+inline void send_string(std::ostream &stream, const std::string &str) {
+    int32_t length = static_cast<int32_t>(str.size());
+    stream.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    stream.write(str.c_str(), length);
+}
+
+template <typename T>
+inline void send(std::ostream &stream, const std::string &name, const T &value) {
+    send_string(stream, name);
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+inline void send(std::ostream &stream, const std::string &name, const std::string &value) {
+    send_string(stream, name);
+    send_string(stream, value);
+}
+
+inline std::string read_string(std::istream &stream) {
+    int32_t length = 0;
+    stream.read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!stream || length <= 0 || length > 80) {
+        throw std::runtime_error("sigproc: invalid string length in header");
+    }
+    std::string str(length, '\0');
+    stream.read(&str[0], length);
+    return str;
+}
+
+template <typename T>
+inline T read_value(std::istream &stream) {
+    T value;
+    stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+    return value;
+}
+
+} // namespace detail
+
+/** @brief check whether `stream` starts with a sigproc header, stream position is restored */
+inline bool is_sigproc(std::istream &stream) {
+    auto position = stream.tellg();
+    int32_t length = 0;
+    char buffer[12];
+    stream.read(reinterpret_cast<char *>(&length), sizeof(length));
+    bool ret = false;
+    if (stream && length == 12) {
+        stream.read(buffer, sizeof(buffer));
+        ret = (stream && std::memcmp(buffer, "HEADER_START", sizeof(buffer)) == 0);
+    }
+    stream.clear();
+    stream.seekg(position);
+    return ret;
+}
+
+/** @brief read header from current position of `stream`, which is left at start of data */
+inline header read_header(std::istream &stream) {
+    using namespace detail;
+    header h;
+    auto begin = stream.tellg();
+    if (read_string(stream) != "HEADER_START") {
+        throw std::runtime_error("sigproc: HEADER_START not found");
+    }
+    while (true) {
+        std::string name = read_string(stream);
+        if (name == "HEADER_END") {
+            break;
+        } else if (name == "telescope_id") {
+            h.telescope_id = read_value<int32_t>(stream);
+        } else if (name == "machine_id") {
+            h.machine_id = read_value<int32_t>(stream);
+        } else if (name == "data_type") {
+            h.data_type = read_value<int32_t>(stream);
+        } else if (name == "rawdatafile") {
+            h.rawdatafile = read_string(stream);
+        } else if (name == "source_name") {
+            h.source_name = read_string(stream);
+        } else if (name == "barycentric") {
+            h.barycentric = read_value<int32_t>(stream);
+        } else if (name == "pulsarcentric") {
+            h.pulsarcentric = read_value<int32_t>(stream);
+        } else if (name == "az_start") {
+            h.az_start = read_value<double>(stream);
+        } else if (name == "za_start") {
+            h.za_start = read_value<double>(stream);
+        } else if (name == "src_raj") {
+            h.src_raj = read_value<double>(stream);
+        } else if (name == "src_dej") {
+            h.src_dej = read_value<double>(stream);
+        } else if (name == "tstart") {
+            h.tstart = read_value<double>(stream);
+        } else if (name == "tsamp") {
+            h.tsamp = read_value<double>(stream);
+        } else if (name == "nbits") {
+            h.nbits = read_value<int32_t>(stream);
+        } else if (name == "nsamples") {
+            h.nsamples = read_value<int32_t>(stream);
+        } else if (name == "fch1") {
+            h.fch1 = read_value<double>(stream);
+        } else if (name == "foff") {
+            h.foff = read_value<double>(stream);
+        } else if (name == "nchans") {
+            h.nchans = read_value<int32_t>(stream);
+        } else if (name == "nifs") {
+            h.nifs = read_value<int32_t>(stream);
+        } else if (name == "nbeams") {
+            h.nbeams = read_value<int32_t>(stream);
+        } else if (name == "ibeam") {
+            h.ibeam = read_value<int32_t>(stream);
+        } else if (name == "refdm") {
+            h.refdm = read_value<double>(stream);
+        } else if (name == "period") {
+            h.period = read_value<double>(stream);
+        } else if (name == "nbins") {
+            h.nbins = read_value<int32_t>(stream);
+        } else if (name == "npuls") {
+            read_value<int64_t>(stream);
+        } else if (name == "signed") {
+            h.signed_ = read_value<char>(stream);
+        } else if (name == "fchannel") {
+            read_value<double>(stream);
+        } else if (name == "FREQUENCY_START" || name == "FREQUENCY_END") {
+            // flags, no value
+        } else {
+            throw std::runtime_error("sigproc: unknown header parameter " + name);
+        }
+        if (!stream) {
+            throw std::runtime_error("sigproc: unexpected end of header");
+        }
+    }
+    h.header_size = static_cast<size_t>(stream.tellg() - begin);
+    return h;
+}
+
+/** @brief write header, time series (data_type = 2) carries refdm instead of channel info */
+inline void write_header(std::ostream &stream, const header &h) {
+    using namespace detail;
+    send_string(stream, "HEADER_START");
+    send(stream, "telescope_id", h.telescope_id);
+    send(stream, "machine_id", h.machine_id);
+    send(stream, "data_type", h.data_type);
+    if (!h.rawdatafile.empty()) {
+        send(stream, "rawdatafile", h.rawdatafile);
+    }
+    if (!h.source_name.empty()) {
+        send(stream, "source_name", h.source_name);
+    }
+    send(stream, "barycentric", h.barycentric);
+    send(stream, "src_raj", h.src_raj);
+    send(stream, "src_dej", h.src_dej);
+    send(stream, "tstart", h.tstart);
+    send(stream, "tsamp", h.tsamp);
+    send(stream, "nbits", h.nbits);
+    send(stream, "fch1", h.fch1);
+    if (h.data_type == 2) {
+        send(stream, "refdm", h.refdm);
+    } else {
+        send(stream, "foff", h.foff);
+    }
+    send(stream, "nchans", h.nchans);
+    send(stream, "nifs", h.nifs);
+    send(stream, "nbeams", h.nbeams);
+    send(stream, "ibeam", h.ibeam);
+    send_string(stream, "HEADER_END");
+}
+
+} // namespace sigproc
+
+#endif // _SIGPROC_HPP
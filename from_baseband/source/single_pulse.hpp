@@ -0,0 +1,247 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// single pulse search of dedispersed time series:
+// baseline by running median, normalization by robust std, matched filter by a ladder of boxcars from prefix sums,
+// and friends-of-friends clustering of candidates across DM trials, boxcar widths and time.
+// inner loops are plain loops over contiguous arrays, so that they are vectorized by the compiler.
+
+#pragma once
+#ifndef _SINGLE_PULSE_HPP
+#define _SINGLE_PULSE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace single_pulse {
+
+/** @brief boxcar of `width` samples starting at `sample` of DM trial `dm_index`, above threshold */
+struct candidate {
+    float snr;
+    uint64_t sample;
+    uint32_t width, filter; // filter is index of width in the ladder
+    uint32_t dm_index;
+};
+
+/** @brief candidates linked together, represented by the one of max snr */
+struct cluster_type {
+    candidate peak;
+    size_t members = 0;
+    uint32_t dm_index_min = 0, dm_index_max = 0;
+    uint64_t first_sample = 0, last_sample = 0; // [first_sample, last_sample) covers boxcars of all members
+    std::vector<candidate> raw;
+};
+
+/** @brief boxcar widths 1, 2, 4, ..., up to `max_width` */
+inline std::vector<uint32_t> boxcar_widths(size_t max_width) {
+    std::vector<uint32_t> widths;
+    for (size_t w = 1; w <= std::max(max_width, static_cast<size_t>(1)); w *= 2) {
+        widths.push_back(static_cast<uint32_t>(w));
+    }
+    return widths;
+}
+
+/** @brief median of `in[0, n)`, `scratch` is used as a copy */
+inline float median(const float *in, size_t n, std::vector<float> &scratch) {
+    scratch.assign(in, in + n);
+    auto middle = scratch.begin() + n / 2;
+    std::nth_element(scratch.begin(), middle, scratch.end());
+    return *middle;
+}
+
+/**
+ * @brief running median of `in[0, n)` over about 5 * `chunk` samples, to `baseline`:
+ *        medians of consecutive chunks, then median of each 5 neighbouring chunk medians,
+ *        linearly interpolated between chunk centres. much cheaper than exact running median with the same response to slow drift.
+ */
+inline void running_median_baseline(const float *in, size_t n, size_t chunk, float *__restrict baseline, std::vector<float> &scratch) {
+    chunk = std::max(std::min(chunk, n), static_cast<size_t>(1));
+    size_t nchunks = (n + chunk - 1) / chunk;
+    std::vector<float> chunk_median(nchunks), smoothed(nchunks);
+    for (size_t k = 0; k < nchunks; k++) {
+        size_t begin = k * chunk;
+        chunk_median[k] = median(in + begin, std::min(chunk, n - begin), scratch);
+    }
+    for (size_t k = 0; k < nchunks; k++) {
+        size_t begin = (k >= 2 ? k - 2 : 0), end = std::min(k + 3, nchunks);
+        smoothed[k] = median(chunk_median.data() + begin, end - begin, scratch);
+    }
+
+    // between centres of chunk k and k + 1, flat before the first centre and after the last one
+    auto centre = [&](size_t k) { return std::min(k * chunk + chunk / 2, n); };
+    std::fill(baseline, baseline + centre(0), smoothed[0]);
+    for (size_t k = 0; k + 1 < nchunks; k++) {
+        size_t begin = centre(k), end = centre(k + 1);
+        float y0 = smoothed[k], slope = (smoothed[k + 1] - y0) / chunk;
+        for (size_t i = begin; i < end; i++) {
+            baseline[i] = y0 + slope * static_cast<float>(i - begin);
+        }
+    }
+    std::fill(baseline + centre(nchunks - 1), baseline + n, smoothed[nchunks - 1]);
+}
+
+/** @brief std of noise in `in[0, n)` by median absolute deviation, robust to pulses and RFI */
+inline float robust_sigma(const float *in, size_t n, std::vector<float> &scratch) {
+    float m = median(in, n, scratch);
+    for (size_t i = 0; i < n; i++) {
+        scratch[i] = std::abs(in[i] - m);
+    }
+    auto middle = scratch.begin() + n / 2;
+    std::nth_element(scratch.begin(), middle, scratch.begin() + n);
+    return 1.4826f * *middle;
+}
+
+/** @brief remove baseline and scale to unit std in place: `x = (x - baseline) / sigma` */
+inline void normalize(float *__restrict x, const float *__restrict baseline, size_t n, std::vector<float> &scratch) {
+    for (size_t i = 0; i < n; i++) {
+        x[i] -= baseline[i];
+    }
+    float sigma = robust_sigma(x, n, scratch);
+    float scale = (sigma > 0.0f ? 1.0f / sigma : 0.0f);
+    for (size_t i = 0; i < n; i++) {
+        x[i] *= scale;
+    }
+}
+
+/**
+ * @brief matched filter of normalized `x[0, nx)` with each boxcar in `widths`, candidates starting in [0, n) are appended to `out`.
+ *        snr of a boxcar is its sum / sqrt(width), taken from prefix sums, so every width costs the same.
+ *        each run of consecutive samples above `threshold` of a width gives one candidate at its max.
+ */
+inline void boxcar_search(const float *x, size_t n, size_t nx, const std::vector<uint32_t> &widths, float threshold, uint32_t dm_index, uint64_t sample_offset, std::vector<candidate> &out,
+                          std::vector<double> &prefix) {
+    // prefix sums in double, as a block is long and float sums of it lose the small boxcars
+    prefix.resize(nx + 1);
+    prefix[0] = 0.0;
+    for (size_t i = 0; i < nx; i++) {
+        prefix[i + 1] = prefix[i] + x[i];
+    }
+
+    constexpr size_t tile = 64;
+    float snr[tile];
+    for (uint32_t f = 0; f < widths.size(); f++) {
+        uint32_t w = widths[f];
+        if (w > nx) {
+            break;
+        }
+        const double scale = 1.0 / std::sqrt(static_cast<double>(w));
+        const double *__restrict lo = prefix.data(), *__restrict hi = prefix.data() + w;
+        size_t limit = std::min(n, nx - w + 1);
+        bool in_run = false;
+        candidate best{};
+        for (size_t begin = 0; begin < limit; begin += tile) {
+            size_t length = std::min(tile, limit - begin);
+            // vectorized: snr of a tile and count above threshold, most tiles are skipped after this
+            size_t above = 0;
+            for (size_t i = 0; i < length; i++) {
+                snr[i] = static_cast<float>((hi[begin + i] - lo[begin + i]) * scale);
+                above += (snr[i] > threshold);
+            }
+            if (above == 0 && !in_run) {
+                continue;
+            }
+            for (size_t i = 0; i < length; i++) {
+                if (snr[i] > threshold) {
+                    if (!in_run || snr[i] > best.snr) {
+                        best = candidate{snr[i], sample_offset + begin + i, w, f, dm_index};
+                    }
+                    in_run = true;
+                } else if (in_run) {
+                    out.push_back(best);
+                    in_run = false;
+                }
+            }
+        }
+        if (in_run) {
+            out.push_back(best);
+        }
+    }
+}
+
+namespace detail {
+
+inline size_t find_root(std::vector<size_t> &parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+} // namespace detail
+
+/**
+ * @brief friends-of-friends clustering: two candidates are linked if their DM trials are at most `dm_tolerance` apart
+ *        and their boxcars, extended by `time_tolerance` samples, overlap. clusters are returned in time order.
+ */
+inline std::vector<cluster_type> cluster(std::vector<candidate> candidates, size_t dm_tolerance, size_t time_tolerance) {
+    std::sort(candidates.begin(), candidates.end(), [](const candidate &a, const candidate &b) { return a.sample < b.sample; });
+    size_t count = candidates.size();
+    std::vector<size_t> parent(count);
+    std::iota(parent.begin(), parent.end(), 0);
+
+    // candidates before `window` end before candidate i starts, so can't link to it or later ones
+    uint64_t max_width = 0;
+    for (const candidate &c : candidates) {
+        max_width = std::max<uint64_t>(max_width, c.width);
+    }
+    size_t window = 0;
+    for (size_t i = 0; i < count; i++) {
+        const candidate &b = candidates[i];
+        while (candidates[window].sample + max_width + time_tolerance < b.sample) {
+            window++;
+        }
+        for (size_t j = window; j < i; j++) {
+            const candidate &a = candidates[j];
+            uint32_t dm_distance = (a.dm_index > b.dm_index ? a.dm_index - b.dm_index : b.dm_index - a.dm_index);
+            if (a.sample + a.width + time_tolerance >= b.sample && dm_distance <= dm_tolerance) {
+                size_t ra = detail::find_root(parent, j), rb = detail::find_root(parent, i);
+                if (ra != rb) {
+                    parent[std::max(ra, rb)] = std::min(ra, rb);
+                }
+            }
+        }
+    }
+
+    // root is the earliest member, so clusters come out in time order
+    std::vector<cluster_type> clusters;
+    std::vector<size_t> cluster_of(count);
+    for (size_t i = 0; i < count; i++) {
+        const candidate &c = candidates[i];
+        size_t root = detail::find_root(parent, i);
+        if (root == i) {
+            cluster_of[i] = clusters.size();
+            cluster_type cl;
+            cl.peak = c;
+            cl.dm_index_min = cl.dm_index_max = c.dm_index;
+            cl.first_sample = c.sample;
+            cl.last_sample = c.sample + c.width;
+            clusters.push_back(cl);
+        } else {
+            cluster_of[i] = cluster_of[root];
+        }
+        cluster_type &cl = clusters[cluster_of[i]];
+        if (c.snr > cl.peak.snr) {
+            cl.peak = c;
+        }
+        cl.members++;
+        cl.dm_index_min = std::min(cl.dm_index_min, c.dm_index);
+        cl.dm_index_max = std::max(cl.dm_index_max, c.dm_index);
+        cl.first_sample = std::min(cl.first_sample, c.sample);
+        cl.last_sample = std::max(cl.last_sample, c.sample + c.width);
+        cl.raw.push_back(c);
+    }
+    return clusters;
+}
+
+} // namespace single_pulse
+
+#endif // _SINGLE_PULSE_HPP
@@ -0,0 +1,188 @@
+/***************************************************************************
+ *
+ *   Copyright (C) 2021 by fxzjshm
+ *   Licensed under the GNU General Public License, version 2.0
+ *
+ ***************************************************************************/
+
+// single pulse search of dedispersed time series (.tim of each DM trial, e.g. output of `dedisperse`),
+// writes clustered candidates to a text list, one line per cluster:
+//     snr  sample  time  filter  dm_index  dm  members  first_sample  last_sample  dm_min  dm_max
+// `filter` is log2 of the boxcar width in samples, `sample` and `time` are start of the boxcar of max snr.
+// time series are memory-mapped and searched in blocks, consecutive blocks overlap by the widest boxcar,
+// clusters are written as soon as no later block can add to them.
+
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "filterbank_file.hpp"
+#include "parallel.hpp"
+#include "single_pulse.hpp"
+#include "stopwatch.h"
+
+int main(int argc, char **argv) {
+    std::ios::sync_with_stdio(false);
+
+    boost::program_options::options_description general_option("General Options"), search_option("Search Options"), all_option("Options");
+    using boost::program_options::value;
+    /* clang-format off */
+    general_option.add_options()
+        ("help,h", "Show help message")
+        ("input_file,f,i", value<std::vector<std::string>>()->multitoken(), "Input time series, one per DM trial, sigproc .tim of 32-bit float")
+        ("output_file,o", value<std::string>(), "Output candidate list")
+        ("threads", value<size_t>()->default_value(0), "Number of threads, 0 to use all cores")
+        ("block_nsamps", value<size_t>()->default_value(65536), "Number of samples searched per block, larger blocks use more memory")
+    ;
+    search_option.add_options()
+        ("threshold", value<float>()->default_value(6.0f), "Min S/N of a candidate")
+        ("max_width", value<size_t>()->default_value(256), "Max boxcar width, in samples; boxcars are 1, 2, 4, ... samples wide")
+        ("baseline_length", value<double>()->default_value(1.0), "Length of running median for baseline, in seconds")
+        ("dm_tolerance", value<size_t>()->default_value(2), "Candidates at most this many DM trials apart may be clustered")
+        ("time_tolerance", value<size_t>()->default_value(0), "Candidates whose boxcars are at most this many samples apart may be clustered")
+        ("min_members", value<size_t>()->default_value(1), "Min number of candidates of a cluster to be written")
+    ;
+    /* clang-format on */
+    all_option.add(general_option).add(search_option);
+    boost::program_options::positional_options_description p;
+    p.add("input_file", -1);
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(all_option).positional(p).run(), vm);
+    boost::program_options::notify(vm);
+
+    if (vm.count("help") || !(vm.count("input_file") && vm.count("output_file"))) {
+        std::cout << general_option << std::endl;
+        std::cout << search_option << std::endl;
+        return vm.count("help") ? 0 : 1;
+    }
+
+    // ------------
+    // Open inputs and set up
+    // ------------
+    std::vector<std::unique_ptr<filterbank_file>> in_files;
+    for (const std::string &in_file_name : vm["input_file"].as<std::vector<std::string>>()) {
+        in_files.emplace_back(new filterbank_file(in_file_name));
+        const sigproc::header &header = in_files.back()->header;
+        if (header.nchans != 1 || header.nbits != 32 || header.tsamp <= 0.0) {
+            std::cerr << in_file_name << " is not a time series of 32-bit float" << std::endl;
+            return 1;
+        }
+        if (header.tsamp != in_files[0]->header.tsamp) {
+            std::cerr << in_file_name << " has different tsamp from " << vm["input_file"].as<std::vector<std::string>>()[0] << std::endl;
+            return 1;
+        }
+    }
+    // DM trials are indexed in order of DM, so that neighbouring trials are clustered;
+    // stable, so that files of equal or missing refdm keep order of command line
+    std::stable_sort(in_files.begin(), in_files.end(), [](const auto &a, const auto &b) { return a->header.refdm < b->header.refdm; });
+    size_t ndm = in_files.size();
+    size_t nsamples = SIZE_MAX;
+    for (const auto &in_file : in_files) {
+        nsamples = std::min(nsamples, in_file->nsamples());
+    }
+    double tsamp = in_files[0]->header.tsamp;
+
+    size_t thread_count = vm["threads"].as<size_t>();
+    if (thread_count == 0) {
+        thread_count = default_thread_count();
+    }
+    std::vector<uint32_t> widths = single_pulse::boxcar_widths(vm["max_width"].as<size_t>());
+    size_t overlap = widths.back() - 1; // boxcars starting near end of a block reach into next one
+    size_t block_nsamps = vm["block_nsamps"].as<size_t>();
+    // running median is over 5 chunks
+    size_t baseline_chunk = std::max(static_cast<size_t>(std::round(vm["baseline_length"].as<double>() / tsamp / 5)), static_cast<size_t>(1));
+    float threshold = vm["threshold"].as<float>();
+    size_t dm_tolerance = vm["dm_tolerance"].as<size_t>(), time_tolerance = vm["time_tolerance"].as<size_t>();
+    size_t min_members = vm["min_members"].as<size_t>();
+
+    std::ofstream out_stream(vm["output_file"].as<std::string>());
+    out_stream << "# snr sample time filter dm_index dm members first_sample last_sample dm_min dm_max" << std::endl;
+
+    std::cout << "ndm = " << ndm << ", " << "dm = [" << in_files.front()->header.refdm << ", " << in_files.back()->header.refdm << "]" << std::endl
+              << "nsamples = " << nsamples << ", " << "tsamp = " << tsamp << std::endl
+              << "widths = [1, " << widths.back() << "], " << "baseline_chunk = " << baseline_chunk << " samples, " << "threshold = " << threshold << std::endl
+              << "threads = " << thread_count << std::endl;
+
+    // ------------
+    // Search block by block
+    // ------------
+    // candidates of each DM trial in a block, and candidates of clusters that may still grow
+    std::vector<std::vector<single_pulse::candidate>> block_candidates(ndm);
+    std::vector<single_pulse::candidate> pending;
+    Stopwatch search_timer, cluster_timer, write_timer;
+    size_t total_candidates = 0, total_clusters = 0;
+    for (size_t begin = 0; begin < nsamples; begin += block_nsamps) {
+        size_t count = std::min(block_nsamps, nsamples - begin);
+        size_t nx = std::min(count + overlap, nsamples - begin);
+
+        // work items are DM trials, buffers are per thread
+        search_timer.start();
+        parallel_for(ndm, thread_count, [&](size_t d) {
+            thread_local std::vector<float> x, baseline, scratch;
+            thread_local std::vector<double> prefix;
+            x.resize(nx);
+            baseline.resize(nx);
+            in_files[d]->block(begin, nx).unpack(x.data());
+            single_pulse::running_median_baseline(x.data(), nx, baseline_chunk, baseline.data(), scratch);
+            single_pulse::normalize(x.data(), baseline.data(), nx, scratch);
+            block_candidates[d].clear();
+            single_pulse::boxcar_search(x.data(), count, nx, widths, threshold, static_cast<uint32_t>(d), begin, block_candidates[d], prefix);
+        });
+        search_timer.stop();
+        for (size_t d = 0; d < ndm; d++) {
+            in_files[d]->prefetch(begin + block_nsamps + overlap, block_nsamps);
+        }
+
+        cluster_timer.start();
+        for (const auto &candidates : block_candidates) {
+            pending.insert(pending.end(), candidates.begin(), candidates.end());
+            total_candidates += candidates.size();
+        }
+        // later candidates start at or after `next_begin`, clusters ending before that are complete
+        size_t next_begin = begin + count;
+        bool last_block = (next_begin >= nsamples);
+        std::vector<single_pulse::cluster_type> clusters = single_pulse::cluster(std::move(pending), dm_tolerance, time_tolerance);
+        pending.clear();
+        std::vector<single_pulse::cluster_type> complete;
+        for (auto &cl : clusters) {
+            if (last_block || cl.last_sample + time_tolerance < next_begin) {
+                complete.push_back(std::move(cl));
+            } else {
+                pending.insert(pending.end(), cl.raw.begin(), cl.raw.end());
+            }
+        }
+        cluster_timer.stop();
+
+        write_timer.start();
+        for (const auto &cl : complete) {
+            if (cl.members < min_members) {
+                continue;
+            }
+            const single_pulse::candidate &peak = cl.peak;
+            out_stream << std::fixed << std::setprecision(2) << peak.snr << " " << peak.sample << " " << std::setprecision(6) << peak.sample * tsamp << " " << peak.filter << " " << peak.dm_index
+                       << " " << std::setprecision(2) << in_files[peak.dm_index]->header.refdm << " " << cl.members << " " << cl.first_sample << " " << cl.last_sample << " "
+                       << in_files[cl.dm_index_min]->header.refdm << " " << in_files[cl.dm_index_max]->header.refdm << "\n";
+            total_clusters++;
+        }
+        write_timer.stop();
+
+        std::cout << "samples searched: " << next_begin << "  "
+                  << "candidates: " << total_candidates << "  "
+                  << "clusters: " << total_clusters << "  "
+                  << "search_timer: " << search_timer.getTime() << "  "
+                  << "cluster_timer: " << cluster_timer.getTime() << "  "
+                  << "write_timer: " << write_timer.getTime() << "    \r";
+        std::cout.flush();
+    }
+    std::cout << std::endl
+              << "total candidates: " << total_candidates << ", " << "clusters written: " << total_clusters << std::endl
+              << "searched " << nsamples * ndm / (search_timer.getTime() + cluster_timer.getTime()) / 1e6 << " M samples/s, " << "real time: " << nsamples * tsamp << " s" << std::endl;
+
+    return 0;
+}
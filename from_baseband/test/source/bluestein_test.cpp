@@ -0,0 +1,74 @@
+// Bluestein fft of lengths clFFT doesn't support, by the tables of bluestein.hpp, against a direct DFT.
+// the steps of bluestein_premultiply(), bluestein_multiply() and bluestein_postmultiply() are redone here,
+// with plain DFTs in place of clFFT's (forward unscaled, backward scaled by 1 / length)
+
+#include <cmath>
+#include <complex>
+#include <random>
+#include <vector>
+
+#include "bluestein.hpp"
+#include "check.hpp"
+#include "checks.hpp"
+
+using complex = std::complex<double>;
+
+static std::vector<complex> dft(const std::vector<complex> &x, int sign) {
+    size_t n = x.size();
+    std::vector<complex> out(n);
+    for (size_t k = 0; k < n; k++) {
+        for (size_t j = 0; j < n; j++) {
+            out[k] += x[j] * std::polar(1.0, sign * 2 * M_PI * static_cast<double>((j * k) % n) / n);
+        }
+    }
+    return out;
+}
+
+/** @brief largest error of Bluestein fft of random `n` samples, relative to the largest value of direct DFT */
+static double bluestein_error(size_t n, bool complex_input) {
+    size_t length = next_fft_length(2 * n - 1);
+    std::vector<float> chirp, kernel;
+    bluestein::tables(n, length, chirp, kernel);
+    std::vector<complex> w(n), v(length);
+    for (size_t j = 0; j < n; j++) {
+        w[j] = complex(chirp[2 * j], chirp[2 * j + 1]);
+    }
+    for (size_t j = 0; j < length; j++) {
+        v[j] = complex(kernel[2 * j], kernel[2 * j + 1]);
+    }
+
+    std::mt19937 rng(static_cast<unsigned>(n));
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<complex> x(n), a(length);
+    for (size_t j = 0; j < n; j++) {
+        x[j] = complex(noise(rng), complex_input ? noise(rng) : 0.0f);
+        a[j] = x[j] * w[j];
+    }
+    std::vector<complex> spectrum = dft(a, -1), kernel_spectrum = dft(v, -1);
+    for (size_t k = 0; k < length; k++) {
+        spectrum[k] *= kernel_spectrum[k];
+    }
+    std::vector<complex> convolution = dft(spectrum, 1);
+
+    std::vector<complex> expected = dft(x, -1);
+    double max_error = 0, max_value = 0;
+    for (size_t k = 0; k < n; k++) {
+        complex out = convolution[k] / static_cast<double>(length) * w[k];
+        max_error = std::max(max_error, std::abs(out - expected[k]));
+        max_value = std::max(max_value, std::abs(expected[k]));
+    }
+    return max_error / max_value;
+}
+
+int main() {
+    // 11 * 13 and a prime, real input as in forward mode, complex input as in zoom mode
+    for (size_t n : {143, 97}) {
+        check(!check_fft_length(n), "length not supported by clFFT");
+        check(check_fft_length(next_fft_length(2 * n - 1)) && next_fft_length(2 * n - 1) >= 2 * n - 1, "convolution length");
+        check(bluestein_error(n, false) < 1e-5, "real input matches direct DFT");
+        check(bluestein_error(n, true) < 1e-5, "complex input matches direct DFT");
+    }
+    // a fast length is unchanged by the circular convolution too
+    check(bluestein_error(64, true) < 1e-5, "fast length matches direct DFT");
+    return test_result("bluestein_test");
+}
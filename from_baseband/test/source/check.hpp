@@ -0,0 +1,22 @@
+// checks shared by host-side tests: a failed check is printed and counted, and main() returns test_result()
+
+#pragma once
+
+#include <iostream>
+
+inline int failures = 0;
+
+inline void check(bool ok, const char *what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/** @brief exit code of test `name` */
+inline int test_result(const char *name) {
+    if (failures == 0) {
+        std::cout << name << " passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
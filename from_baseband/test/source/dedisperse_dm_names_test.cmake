@@ -0,0 +1,24 @@
+# run dedisperse over a DM grid finer than 0.01 and check that one .tim is written per trial
+# usage: cmake -D DEDISPERSE=<path of dedisperse> -D WORK_DIR=<scratch directory> -P dedisperse_dm_names_test.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+# raw input of 16 float channels, 256 samples; values don't matter here
+string(REPEAT "0" 16384 raw)
+file(WRITE "${WORK_DIR}/raw.dat" "${raw}")
+
+execute_process(
+    COMMAND "${DEDISPERSE}" -i raw.dat --nchans 16 --tsamp 0.001 --fch1 1400 --foff -1 --dm_min 0 --dm_max 0.05 --dm_step 0.001 -o fine
+    WORKING_DIRECTORY "${WORK_DIR}"
+    RESULT_VARIABLE result
+    OUTPUT_QUIET
+)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "dedisperse exited with ${result}")
+endif()
+
+file(GLOB outputs "${WORK_DIR}/fine_DM*.tim")
+list(LENGTH outputs count)
+if(NOT count EQUAL 51)
+  message(FATAL_ERROR "expected 51 output files, one per DM trial, got ${count}")
+endif()
@@ -0,0 +1,82 @@
+// round trip of bit shuffle and of .fbz writer & reader
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "fbz.hpp"
+
+static void test_bitshuffle() {
+    std::mt19937 rng(1);
+    for (size_t element_size : {1, 2, 4, 8}) {
+        // a count that isn't a multiple of 8 has a tail copied as is
+        for (size_t count : {0, 5, 8, 64, 1003}) {
+            std::vector<uint8_t> in(count * element_size), shuffled(in.size()), out(in.size());
+            for (auto &b : in) {
+                b = static_cast<uint8_t>(rng());
+            }
+            fbz::bitshuffle(in.data(), shuffled.data(), count, element_size);
+            fbz::bitunshuffle(shuffled.data(), out.data(), count, element_size);
+            check(in == out, "bitunshuffle(bitshuffle(x)) == x");
+        }
+    }
+}
+
+static void test_writer_reader() {
+    const size_t nchans = 37, nsamps = 10000, chunk_nsamps = 256;
+    const size_t sample_bytes = nchans * sizeof(float);
+    std::string file_name = (std::filesystem::temp_directory_path() / "fbz_test.fbz").string();
+    std::string sigproc_header = "HEADER_START ... HEADER_END";
+
+    // slowly varying values, like a filterbank
+    std::mt19937 rng(2);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<float> data(nsamps * nchans);
+    for (size_t t = 0; t < nsamps; t++) {
+        for (size_t c = 0; c < nchans; c++) {
+            data[t * nchans + c] = 100.0f + c + noise(rng);
+        }
+    }
+
+    {
+        fbz::writer writer(file_name, sigproc_header, sizeof(float), sample_bytes, chunk_nsamps, 3, 1);
+        // pieces that don't line up with chunks
+        size_t begin = 0;
+        for (size_t piece : {1, 300, 255, 4000}) {
+            writer.write(data.data() + begin * nchans, piece);
+            begin += piece;
+        }
+        writer.write(data.data() + begin * nchans, nsamps - begin);
+        writer.close();
+    }
+
+    fbz::reader reader(file_name);
+    check(reader.element_size == sizeof(float), "element_size");
+    check(reader.sample_bytes == sample_bytes, "sample_bytes");
+    check(reader.chunk_nsamps == chunk_nsamps, "chunk_nsamps");
+    check(reader.sigproc_header == sigproc_header, "sigproc header");
+    check(reader.nsamples == nsamps, "nsamples");
+    check(reader.index.size() == (nsamps + chunk_nsamps - 1) / chunk_nsamps, "chunk count");
+
+    std::vector<float> out(nsamps * nchans);
+    check(reader.read(0, nsamps, out.data()) == nsamps, "read count of whole file");
+    check(out == data, "whole file round trip");
+
+    // a range across chunk boundaries, and one past end
+    size_t begin = 1000, count = 700;
+    std::vector<float> part(count * nchans);
+    check(reader.read(begin, count, part.data()) == count, "read count of range");
+    check(std::equal(part.begin(), part.end(), data.begin() + begin * nchans), "range round trip");
+    check(reader.read(nsamps - 10, 100, part.data()) == 10, "read count past end");
+
+    std::filesystem::remove(file_name);
+}
+
+int main() {
+    test_bitshuffle();
+    test_writer_reader();
+    return test_result("fbz_test");
+}
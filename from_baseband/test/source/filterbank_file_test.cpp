@@ -0,0 +1,122 @@
+// reading sigproc files of every supported nbits: block views, unpacking, overlapping blocks and bad arguments
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "filterbank_file.hpp"
+
+static const size_t nsamps = 37, nchans = 16, nifs = 2;
+
+/** @brief value of channel `c` of IF `i` of sample `t`, fitting in `nbits` */
+static uint32_t expected(size_t t, size_t i, size_t c, int nbits) {
+    uint32_t v = static_cast<uint32_t>(t * 7 + i * 3 + c);
+    return nbits >= 16 ? v : v % (1u << nbits);
+}
+
+/** @brief write a sigproc file of `nbits` samples, packed from the lowest bits as sigproc does */
+static void write_file(const std::string &file_name, int nbits) {
+    sigproc::header h;
+    h.nbits = nbits;
+    h.nchans = nchans;
+    h.nifs = nifs;
+    h.tsamp = 1e-3;
+    h.fch1 = 1400.0;
+    h.foff = -1.0;
+    std::ofstream stream(file_name, std::ios::binary);
+    sigproc::write_header(stream, h);
+    std::vector<char> sample(h.bytes_per_sample());
+    for (size_t t = 0; t < nsamps; t++) {
+        std::fill(sample.begin(), sample.end(), 0);
+        for (size_t i = 0; i < nifs; i++) {
+            for (size_t c = 0; c < nchans; c++) {
+                size_t index = i * nchans + c;
+                uint32_t v = expected(t, i, c, nbits);
+                if (nbits == 32) {
+                    float f = static_cast<float>(v);
+                    std::memcpy(sample.data() + index * 4, &f, 4);
+                } else if (nbits == 16) {
+                    uint16_t u = static_cast<uint16_t>(v);
+                    std::memcpy(sample.data() + index * 2, &u, 2);
+                } else {
+                    size_t bit = index * nbits;
+                    sample[bit / 8] |= static_cast<char>(v << (bit % 8));
+                }
+            }
+        }
+        stream.write(sample.data(), sample.size());
+    }
+}
+
+/** @brief all values of `view` are those of IF `if_index`, by value() and both unpack() */
+static bool view_matches(const block_view &view, size_t if_index, int nbits) {
+    bool ok = true;
+    std::vector<float> row(view.nchans), all(view.nsamps * view.nchans);
+    view.unpack(all.data());
+    for (size_t t = 0; t < view.nsamps; t++) {
+        view.unpack(t, row.data());
+        for (size_t c = 0; c < view.nchans; c++) {
+            float v = static_cast<float>(expected(view.sample_begin + t, if_index, view.chan_begin + c, nbits));
+            ok = ok && view.value(t, c) == v && row[c] == v && all[t * view.nchans + c] == v;
+        }
+    }
+    return ok;
+}
+
+static void test_nbits(int nbits) {
+    std::string file_name = (std::filesystem::temp_directory_path() / ("filterbank_file_test_" + std::to_string(nbits) + ".fil")).string();
+    write_file(file_name, nbits);
+    {
+        filterbank_file file(file_name);
+        check(file.header.nbits == nbits && file.header.nifs == static_cast<int32_t>(nifs), "header");
+        check(file.nsamples() == nsamps, "nsamples");
+
+        block_view view = file.block(3, 5, 2, 6, 1);
+        check(view.sample_begin == 3 && view.nsamps == 5 && view.chan_begin == 2 && view.nchans == 6, "block shape");
+        check(view_matches(view, 1, nbits), "block values of second IF");
+        check(view_matches(file.block(0, nsamps), 0, nbits), "whole file of first IF");
+        // odd channel offset starts inside a byte for nbits < 8
+        check(view_matches(file.block(10, 4, 5, 3, 0), 0, nbits), "block at odd channel");
+        view = file.block(nsamps - 2, 10, 12, 10);
+        check(view.nsamps == 2 && view.nchans == 4, "block clamped to file");
+
+        // blocks of 8 samples every 5 samples, each overlapping the next one by 3
+        size_t count = 0;
+        bool ok = true;
+        for (block_view b : file.blocks(8, 5, 0, SIZE_MAX, 1)) {
+            ok = ok && b.sample_begin == count * 5 && b.nsamps == std::min<size_t>(8, nsamps - count * 5) && view_matches(b, 1, nbits);
+            count++;
+        }
+        check(ok, "blocks values and overlap");
+        check(count == 1 + (nsamps - 8 + 4) / 5, "blocks count");
+
+        bool thrown = false;
+        try {
+            file.block(0, 1, 0, nchans, nifs);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        check(thrown, "IF out of range throws");
+        thrown = false;
+        try {
+            file.blocks(8, 0);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        check(thrown, "step 0 throws");
+    }
+    std::filesystem::remove(file_name);
+}
+
+int main() {
+    for (int nbits : {1, 2, 4, 8, 16, 32}) {
+        test_nbits(nbits);
+    }
+    return test_result("filterbank_file_test");
+}
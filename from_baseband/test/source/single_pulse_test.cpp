@@ -0,0 +1,90 @@
+// single pulse search of synthetic DM trials: noise on a drifting baseline, with one injected pulse
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "check.hpp"
+#include "single_pulse.hpp"
+
+static void test_baseline() {
+    // a slow ramp is followed exactly between the first and last chunk centres
+    const size_t n = 10000, chunk = 100;
+    std::vector<float> x(n), baseline(n), scratch;
+    for (size_t i = 0; i < n; i++) {
+        x[i] = 0.01f * i;
+    }
+    single_pulse::running_median_baseline(x.data(), n, chunk, baseline.data(), scratch);
+    float max_error = 0.0f;
+    for (size_t i = 3 * chunk; i < n - 3 * chunk; i++) {
+        max_error = std::max(max_error, std::abs(baseline[i] - x[i]));
+    }
+    check(max_error < 0.02f, "running median follows a ramp");
+}
+
+static void test_search() {
+    const size_t n = 1 << 16, ndm = 8, chunk = 1000;
+    const uint64_t pulse_sample = 20000;
+    const uint32_t pulse_width = 8, pulse_dm = 4;
+    std::vector<uint32_t> widths = single_pulse::boxcar_widths(64);
+
+    std::mt19937 rng(3);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+    std::vector<single_pulse::candidate> candidates;
+    std::vector<float> x(n), baseline(n), scratch;
+    std::vector<double> prefix;
+    for (uint32_t d = 0; d < ndm; d++) {
+        for (size_t i = 0; i < n; i++) {
+            x[i] = 50.0f + 5.0f * std::sin(2.0f * static_cast<float>(M_PI) * i / n) + noise(rng);
+        }
+        // strongest at pulse_dm, smeared and weaker in neighbouring trials, snr = amplitude * sqrt(width)
+        uint32_t distance = (d > pulse_dm ? d - pulse_dm : pulse_dm - d);
+        float amplitude = (distance == 0 ? 5.0f : distance == 1 ? 3.0f : 0.0f);
+        for (size_t i = pulse_sample; i < pulse_sample + pulse_width; i++) {
+            x[i] += amplitude;
+        }
+        single_pulse::running_median_baseline(x.data(), n, chunk, baseline.data(), scratch);
+        single_pulse::normalize(x.data(), baseline.data(), n, scratch);
+        single_pulse::boxcar_search(x.data(), n, n, widths, 7.0f, d, 0, candidates, prefix);
+    }
+
+    std::vector<single_pulse::cluster_type> clusters = single_pulse::cluster(candidates, 1, 0);
+    check(clusters.size() == 1, "one cluster, no false positives");
+    if (clusters.empty()) {
+        return;
+    }
+    const single_pulse::cluster_type &cl = clusters[0];
+    check(cl.peak.dm_index == pulse_dm, "peak at injected DM");
+    check(cl.peak.width == pulse_width, "peak at injected width");
+    check(cl.peak.sample == pulse_sample, "peak at injected sample");
+    check(cl.peak.snr > 11.0f && cl.peak.snr < 17.0f, "peak snr near 5 * sqrt(8)");
+    check(cl.dm_index_min == pulse_dm - 1 && cl.dm_index_max == pulse_dm + 1, "cluster spans neighbouring DM trials");
+    check(cl.first_sample <= pulse_sample && cl.last_sample >= pulse_sample + pulse_width, "cluster covers the pulse");
+}
+
+static void test_cluster_links() {
+    using single_pulse::candidate;
+    // linked through b across time, c is too far in DM from all, d is too far in time
+    std::vector<candidate> candidates = {
+        {8.0f, 100, 4, 2, 0},  // a
+        {9.0f, 103, 4, 2, 1},  // b
+        {7.0f, 106, 2, 1, 2},  // linked to b
+        {10.0f, 101, 1, 0, 6}, // c
+        {7.5f, 200, 4, 2, 1},  // d
+    };
+    std::vector<single_pulse::cluster_type> clusters = single_pulse::cluster(candidates, 1, 0);
+    check(clusters.size() == 3, "three clusters");
+    if (clusters.size() == 3) {
+        check(clusters[0].members == 3 && clusters[0].peak.snr == 9.0f, "friends of friends are linked");
+        check(clusters[1].members == 1 && clusters[1].peak.dm_index == 6, "far DM is apart");
+        check(clusters[2].members == 1 && clusters[2].peak.sample == 200, "far time is apart, clusters in time order");
+    }
+}
+
+int main() {
+    test_baseline();
+    test_search();
+    test_cluster_links();
+    return test_result("single_pulse_test");
+}
@@ -41,6 +41,18 @@ MCAST_GRP = '10.0.1.2'
 MCAST_PORT = 12001
 BUFFER_SIZE = 10240
 
+# multi-beam (udp_receiver.cpp): (group, port) of each beam, ibeam in header is the index in this list
+beam_addresses = [(MCAST_GRP, MCAST_PORT + i) for i in range(nbeams)]
+MCAST_IF = "0.0.0.0"  # address of interface joining multicast groups
+socket_buffer_size = 64 << 20  # SO_RCVBUF of each beam, check net.core.rmem_max
+recv_threads = 4  # receive threads shared by all beams
+recv_batch = 64  # packets received by one recvmmsg()
+write_threads = 2  # threads writing files of all beams
+block_nsamples = 4096  # samples written at a time
+blocks_per_beam = 8  # buffer of a beam is blocks_per_beam * block_nsamples samples, packets are dropped when it's full
+stat_interval = 10  # seconds between printing counters of each beam
+restart_threshold = 1 << 16  # counter going back by at least this many samples is sender restarted, by less is reordering
+
 # misc
 # it is said that in formal observe the udp pack counter (first 8 bytes of a packet, in `uint64`` or `unsigned long long`) should start with 0
 start_from_counter_zero = False
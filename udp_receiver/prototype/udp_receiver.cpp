@@ -1,11 +1,12 @@
 #if 0
     EXEC=${0%.*}
-    c++ "$0" -std=c++20 -o "$EXEC" -O3 -march=native -l boost_system
+    PYTHON_VERSION=$(python3 -c 'import sys; print(*sys.version_info[:2], sep="")')
+    c++ "$0" -std=c++20 -o "$EXEC" -O3 -march=native -pthread $(python3-config --includes) -l boost_python${PYTHON_VERSION} $(python3-config --embed --ldflags)
     exec "$EXEC"
 #endif
 // ^ ref: https://stackoverflow.com/questions/2482348/run-c-or-c-file-as-a-script
 
-/******************************************************************************* 
+/*******************************************************************************
  * Copyright (c) 2022 fxzjshm
  * This software is licensed under Mulan PubL v2.
  * You can use this software according to the terms and conditions of the Mulan PubL v2.
@@ -17,58 +18,84 @@
  * See the Mulan PubL v2 for more details.
  ******************************************************************************/
 
-// @deprecated currently in favour of the rust version
+// multi-beam receiver: one process receives all beams listed in `beam_addresses` of srtb_config.py,
+// for a single beam the rust version is still fine.
+//
+// sockets of all beams are registered in one epoll instance (EPOLLONESHOT), a pool of `recv_threads`
+// receive threads takes whichever beam is readable, drains it with recvmmsg() and re-arms it,
+// so a beam is handled by one thread at a time and packets of a beam stay in order.
+// samples are converted into fixed-size blocks taken from a per-beam pool, full blocks are written by
+// `write_threads` writer threads with pwrite() at their offset in the file, so memory used is bounded by
+//     nbeams * blocks_per_beam * block_nsamples * sample size
+// and when writing can't keep up, packets are dropped (and counted) instead of growing buffers.
 
 // some notice:
 // * avoid usage of pointers, use RAII instead
 // * check index, do not write out of buffer
 
-#include <boost/asio.hpp>
-#include <boost/program_options.hpp>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <boost/python.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 namespace srtb {
 namespace prototype {
 namespace udp_receiver {
 
-/** 
- * @brief just another implementations of part of sigproc headers 
+/**
+ * @brief just another implementations of part of sigproc headers
  * ref: sigproc/filterbank_header.c
  */
 namespace sigproc {
 namespace filterbank_header {
 
-template <typename Stream, typename T>
-inline void send(Stream& stream, const T& value)
-  requires(std::is_pod_v<T>)
-{
-  constexpr size_t size = sizeof(value);
-  constexpr int32_t prepend_size = size;
+template <typename Stream>
+inline void send(Stream& stream, const std::string& value) {
+  const int32_t prepend_size = value.size();
   stream.write(reinterpret_cast<const char*>(&prepend_size),
                sizeof(prepend_size));
-  stream.write(reinterpret_cast<const char*>(&value), size);
+  stream.write(value.c_str(), value.size());
 }
 
 template <typename Stream, typename T>
-inline void send(Stream& stream, const T& value)
-  requires(std::is_same_v<T, std::string>)
+inline void send(Stream& stream, const std::string& name, const T& value)
+  requires(std::is_arithmetic_v<T>)
 {
-  constexpr size_t size = value.size();
-  constexpr int32_t prepend_size = size;
-  stream.write(reinterpret_cast<const char*>(&prepend_size),
-               sizeof(prepend_size));
-  stream.write(value.c_str(), size);
+  send(stream, name);
+  stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
 }
 
-template <typename Stream, typename T, typename... Args>
-inline void send(Stream& stream, const T& value, Args... args) {
+template <typename Stream>
+inline void send(Stream& stream, const std::string& name,
+                 const std::string& value) {
+  send(stream, name);
   send(stream, value);
-  send(stream, args);
 }
 
 }  // namespace filterbank_header
@@ -78,43 +105,737 @@ inline void send(Stream& stream, const T& value, Args... args) {
 namespace global {
 inline const std::string config_file_name = "srtb_config.py";
 
-inline boost::program_options::variables_map config;
+inline std::atomic<bool> running = true;
 }  // namespace global
 
-template <typename Stream>
-inline void generate_filterbank_header(Stream& file_stream) {
-  using namespace sigproc::filterbank_header;
-  send(file_stream, "HEADER_START");
-  send(file_stream, "telescope_id", srtb_config.telescope_id);
-  send(file_stream, "machine_id", srtb_config.machine_id);
-  send(file_stream, "rawdatafile", srtb_config.rawdatafile);
-  send(file_stream, "source_name", srtb_config.source_name);
-  send(file_stream, "data_type", srtb_config.data_type);
-  send(file_stream, "fch1", srtb_config.fch1);
-  send(file_stream, "foff", srtb_config.foff);
-  send(file_stream, "nchans", srtb_config.nchans);
-  send(file_stream, "tsamp", srtb_config.tsamp);
-  send(file_stream, "nbeams", srtb_config.nbeams);
-  send(file_stream, "nbits", srtb_config.nbits);
-  send(file_stream, "nifs", srtb_config.nifs);
-  send(file_stream, "src_raj", srtb_config.src_raj);
-  send(file_stream, "src_dej", srtb_config.src_dej);
-  send(file_stream, "tstart", srtb_config.tstart);
-  send(file_stream, "nsamples", srtb_config.nsamples);
-  send(file_stream, "HEADER_END");
+/** @brief values read from srtb_config.py */
+struct config_type {
+  // header
+  int32_t telescope_id, machine_id, data_type, nchans, nbits, nifs;
+  std::string source_name;
+  double fch1, foff, tsamp, src_raj, src_dej;
+  // file
+  size_t nsamples;
+  std::string filename_prefix, data_location;
+  bool sum_ifs, deinterlace_channel, reverse_channel;
+  // udp
+  std::vector<std::pair<std::string, uint16_t>> beam_addresses;
+  std::string mcast_interface;
+  size_t buffer_size, socket_buffer_size;
+  // threads & memory
+  size_t recv_threads, recv_batch, write_threads, block_nsamples,
+      blocks_per_beam, stat_interval;
+  // a step back of counter by at least this many samples is taken as sender restarted, a smaller one as reordering
+  uint64_t restart_threshold;
+};
+
+inline config_type read_config() {
+  namespace py = boost::python;
+  Py_Initialize();
+  py::import("sys").attr("path").attr("append")(
+      std::filesystem::current_path().string());
+  py::object srtb_config = py::import(
+      std::filesystem::path(global::config_file_name).stem().c_str());
+  auto get = [&](const char* name) { return srtb_config.attr(name); };
+  auto has = [&](const char* name) {
+    return PyObject_HasAttrString(srtb_config.ptr(), name) != 0;
+  };
+
+  config_type config;
+  config.telescope_id = py::extract<int32_t>(get("telescope_id"));
+  config.machine_id = py::extract<int32_t>(get("machine_id"));
+  config.data_type = py::extract<int32_t>(get("data_type"));
+  config.nchans = py::extract<int32_t>(get("nchans"));
+  config.nbits = py::extract<int32_t>(get("nbits"));
+  config.nifs = py::extract<int32_t>(get("nifs"));
+  config.source_name = py::extract<std::string>(get("source_name"));
+  config.fch1 = py::extract<double>(get("fch1"));
+  config.foff = py::extract<double>(get("foff"));
+  config.tsamp = py::extract<double>(get("tsamp"));
+  config.src_raj = py::extract<double>(get("src_raj"));
+  config.src_dej = py::extract<double>(get("src_dej"));
+  config.nsamples = py::extract<size_t>(get("nsamples"));
+  config.filename_prefix = py::extract<std::string>(get("filename_prefix"));
+  config.data_location = py::extract<std::string>(get("data_location"));
+  config.sum_ifs = py::extract<bool>(get("sum_ifs"));
+  config.deinterlace_channel = py::extract<bool>(get("deinterlace_channel"));
+  config.reverse_channel = py::extract<bool>(get("reverse_channel"));
+  config.buffer_size = py::extract<size_t>(get("BUFFER_SIZE"));
+
+  // one beam at MCAST_GRP:MCAST_PORT if beam_addresses is not given
+  if (has("beam_addresses")) {
+    py::object addresses = get("beam_addresses");
+    for (py::ssize_t i = 0; i < py::len(addresses); i++) {
+      config.beam_addresses.emplace_back(
+          py::extract<std::string>(addresses[i][0]),
+          py::extract<uint16_t>(addresses[i][1]));
+    }
+  } else {
+    config.beam_addresses.emplace_back(
+        py::extract<std::string>(get("MCAST_GRP")),
+        py::extract<uint16_t>(get("MCAST_PORT")));
+  }
+  auto get_or = [&](const char* name, auto default_value) {
+    using T = decltype(default_value);
+    return has(name) ? T{py::extract<T>(get(name))} : default_value;
+  };
+  config.mcast_interface =
+      get_or("MCAST_IF", std::string{"0.0.0.0"});
+  config.socket_buffer_size =
+      get_or("socket_buffer_size", size_t{64 << 20});
+  config.recv_threads = get_or("recv_threads", size_t{4});
+  config.recv_batch = get_or("recv_batch", size_t{64});
+  config.write_threads = get_or("write_threads", size_t{2});
+  config.block_nsamples = get_or("block_nsamples", size_t{4096});
+  config.blocks_per_beam = get_or("blocks_per_beam", size_t{8});
+  config.stat_interval = get_or("stat_interval", size_t{10});
+  config.restart_threshold = get_or("restart_threshold", uint64_t{1} << 16);
+
+  if (config.nbits != 8) {
+    throw std::runtime_error("only nbits == 8 is supported by this version");
+  }
+  if (config.beam_addresses.empty() || config.recv_threads == 0 ||
+      config.write_threads == 0 || config.recv_batch == 0 ||
+      config.block_nsamples == 0 || config.blocks_per_beam < 2 ||
+      config.nsamples == 0 || config.restart_threshold == 0) {
+    throw std::runtime_error(
+        "need at least 1 beam, receive thread, write thread and 2 blocks per "
+        "beam, and nonzero nsamples and restart_threshold");
+  }
+  return config;
 }
 
-inline void read_config() {
-  boost::program_options::options_description dummy_option("");
-  boost::program_options::store(
-      boost::program_options::parse_config_file<char>(
-          global::config_file_name.c_str(), dummy_option,
-          /* allow_unregistered = */ true),
-      global::config);
-  boost::program_options::notify(global::config);
+using counter_type = uint64_t;
+inline constexpr size_t counter_size = sizeof(counter_type);
+
+/** @brief current time in MJD */
+inline double mjd_now() {
+  constexpr double seconds_of_a_day = 24 * 60 * 60, mjd_of_unix_epoch = 40587;
+  auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+  return std::chrono::duration<double>(since_epoch).count() /
+             seconds_of_a_day +
+         mjd_of_unix_epoch;
 }
 
-inline int main() { return EXIT_SUCCESS; }
+/** @brief a .fil file, closed (and padded to `length` if tail is lost) when the last block written to it is released */
+struct output_file {
+  int fd = -1;
+  std::string path;
+  std::atomic<off_t> length = 0;
+
+  explicit output_file(const std::string& path_) : path(path_) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + path + ": " +
+                               std::strerror(errno));
+    }
+  }
+  output_file(const output_file&) = delete;
+  output_file& operator=(const output_file&) = delete;
+
+  ~output_file() {
+    if (ftruncate(fd, length) != 0) {
+      std::cerr << "[output_file] warning: cannot set length of " << path
+                << ": " << std::strerror(errno) << std::endl;
+    }
+    close(fd);
+  }
+};
+
+struct beam_type;
+
+/** @brief consecutive samples of a beam, written at `offset` of `file` */
+struct block_type {
+  std::vector<char> data;
+  size_t nsamples = 0;
+  uint64_t first_sample = 0;  // index of sample 0 of this block in file
+  off_t offset = 0;
+  std::shared_ptr<output_file> file;
+  beam_type* beam = nullptr;
+};
+
+/** @brief counters of a beam, updated by receive & write threads, read by main thread */
+struct beam_stat {
+  std::atomic<uint64_t> received_packets = 0, lost_packets = 0,
+                        dropped_packets = 0, bad_length_packets = 0,
+                        out_of_order_packets = 0, written_bytes = 0,
+                        files = 0, restarts = 0, file_errors = 0;
+};
+
+struct beam_type {
+  size_t ibeam;
+  std::string address;
+  uint16_t port;
+  int socket_fd = -1;
+  beam_stat stat;
+
+  // held by the receive thread handling this beam, EPOLLONESHOT already makes it exclusive,
+  // this also makes the state visible to the next thread
+  std::mutex mutex;
+  std::shared_ptr<output_file> file;
+  size_t header_size = 0;
+  double file_tstart = 0;
+  counter_type file_first_counter = 0;  // counter of sample 0 of file
+  counter_type last_counter = 0;
+  bool last_counter_set = false;
+  block_type* current = nullptr;  // block being filled, nullptr if none is free
+
+  // blocks not being filled or written
+  std::mutex free_mutex;
+  std::vector<block_type*> free_blocks;
+  std::vector<block_type> blocks;
+
+  beam_type() = default;
+  beam_type(const beam_type&) = delete;
+  beam_type& operator=(const beam_type&) = delete;
+  ~beam_type() {
+    if (socket_fd >= 0) {
+      close(socket_fd);
+    }
+  }
+};
+
+/** @brief full blocks of all beams, waiting to be written */
+struct write_queue_type {
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<block_type*> blocks;
+  bool closed = false;
+
+  void push(block_type* block) {
+    {
+      std::lock_guard lock{mutex};
+      blocks.push_back(block);
+    }
+    condition.notify_one();
+  }
+
+  /** @return nullptr if closed and empty */
+  block_type* pop() {
+    std::unique_lock lock{mutex};
+    condition.wait(lock, [&] { return closed || !blocks.empty(); });
+    if (blocks.empty()) {
+      return nullptr;
+    }
+    block_type* block = blocks.front();
+    blocks.pop_front();
+    return block;
+  }
+
+  void close() {
+    {
+      std::lock_guard lock{mutex};
+      closed = true;
+    }
+    condition.notify_all();
+  }
+};
+
+class receiver {
+ public:
+  const config_type& config;
+  size_t written_sample_size, received_sample_size;
+  std::vector<std::unique_ptr<beam_type>> beams;
+  write_queue_type write_queue;
+  int epoll_fd = -1;
+
+  explicit receiver(const config_type& config_) : config(config_) {
+    written_sample_size = config.nifs * config.nchans * config.nbits / 8;
+    received_sample_size = written_sample_size * (config.sum_ifs ? 2 : 1);
+    if (counter_size + received_sample_size > config.buffer_size) {
+      throw std::runtime_error("BUFFER_SIZE is less than a packet");
+    }
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+      throw std::runtime_error(std::string{"epoll_create1: "} +
+                               std::strerror(errno));
+    }
+    for (size_t i = 0; i < config.beam_addresses.size(); i++) {
+      auto beam = std::make_unique<beam_type>();
+      beam->ibeam = i;
+      beam->address = config.beam_addresses[i].first;
+      beam->port = config.beam_addresses[i].second;
+      beam->blocks.resize(config.blocks_per_beam);
+      for (block_type& block : beam->blocks) {
+        block.data.resize(config.block_nsamples * written_sample_size);
+        block.beam = beam.get();
+        beam->free_blocks.push_back(&block);
+      }
+      beam->socket_fd = open_socket(*beam);
+      epoll_event event{};
+      event.events = EPOLLIN | EPOLLONESHOT;
+      event.data.ptr = beam.get();
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, beam->socket_fd, &event) != 0) {
+        throw std::runtime_error(std::string{"epoll_ctl: "} +
+                                 std::strerror(errno));
+      }
+      beams.push_back(std::move(beam));
+    }
+  }
+
+  receiver(const receiver&) = delete;
+  receiver& operator=(const receiver&) = delete;
+
+  ~receiver() { close(epoll_fd); }
+
+  /** @brief bind to port of the beam and join its group if it is a multicast one */
+  int open_socket(const beam_type& beam) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+    if (fd < 0) {
+      throw std::runtime_error(std::string{"socket: "} +
+                               std::strerror(errno));
+    }
+    auto check = [&](int ret, const std::string& what) {
+      if (ret != 0) {
+        std::string message = what + " of beam " + std::to_string(beam.ibeam) +
+                              " (" + beam.address + ":" +
+                              std::to_string(beam.port) +
+                              "): " + std::strerror(errno);
+        close(fd);
+        throw std::runtime_error(message);
+      }
+    };
+    int yes = 1;
+    check(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)),
+          "SO_REUSEADDR");
+    int rcvbuf = static_cast<int>(config.socket_buffer_size);
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0) {
+      std::cerr << "[receiver] warning: cannot set SO_RCVBUF to " << rcvbuf
+                << std::endl;
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(beam.port);
+    check(inet_pton(AF_INET, beam.address.c_str(), &address.sin_addr) == 1
+              ? 0
+              : -1,
+          "address");
+    // on this port, listen ONLY to this group, as udp_receiver.py does
+    check(bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)),
+          "bind");
+    if (IN_MULTICAST(ntohl(address.sin_addr.s_addr))) {
+      ip_mreq request{};
+      request.imr_multiaddr = address.sin_addr;
+      check(inet_pton(AF_INET, config.mcast_interface.c_str(),
+                      &request.imr_interface) == 1
+                ? 0
+                : -1,
+            "MCAST_IF");
+      check(setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+                       sizeof(request)),
+            "IP_ADD_MEMBERSHIP");
+    }
+    return fd;
+  }
+
+  /** @brief sigproc header of a new file of `beam` */
+  std::string filterbank_header(const beam_type& beam,
+                                const std::string& file_name,
+                                double tstart) const {
+    using namespace sigproc::filterbank_header;
+    std::ostringstream stream;
+    send(stream, "HEADER_START");
+    send(stream, "telescope_id", config.telescope_id);
+    send(stream, "machine_id", config.machine_id);
+    send(stream, "rawdatafile", file_name);
+    send(stream, "source_name", config.source_name);
+    send(stream, "data_type", config.data_type);
+    send(stream, "fch1", config.fch1);
+    send(stream, "foff", config.foff);
+    send(stream, "nchans", config.nchans);
+    send(stream, "tsamp", config.tsamp);
+    send(stream, "nbeams", static_cast<int32_t>(beams.size()));
+    send(stream, "ibeam", static_cast<int32_t>(beam.ibeam));
+    send(stream, "nbits", config.nbits);
+    send(stream, "nifs", config.nifs);
+    send(stream, "src_raj", config.src_raj);
+    send(stream, "src_dej", config.src_dej);
+    send(stream, "tstart", tstart);
+    send(stream, "HEADER_END");
+    return stream.str();
+  }
+
+  /** @brief start a new file of the beam, whose sample 0 has counter `first_counter` */
+  void roll_file(beam_type& beam, counter_type first_counter, double tstart) {
+    finish_file(beam);
+    std::ostringstream file_name;
+    file_name << config.filename_prefix << "_beam" << std::setw(2)
+              << std::setfill('0') << beam.ibeam << "_" << std::fixed
+              << std::setprecision(8) << tstart << ".fil";
+    std::string header = filterbank_header(beam, file_name.str(), tstart);
+    beam.file = std::make_shared<output_file>(config.data_location +
+                                              file_name.str());
+    if (pwrite(beam.file->fd, header.data(), header.size(), 0) !=
+        static_cast<ssize_t>(header.size())) {
+      throw std::runtime_error("cannot write header of " + beam.file->path);
+    }
+    beam.file->length = header.size();
+    beam.header_size = header.size();
+    beam.file_tstart = tstart;
+    beam.file_first_counter = first_counter;
+    beam.stat.files++;
+    std::cout << "[receiver] beam " << beam.ibeam << " receiving to "
+              << beam.file->path << std::endl;
+  }
+
+  /** @brief submit block being filled, and let the file be closed after its blocks are written */
+  void finish_file(beam_type& beam) {
+    submit_block(beam);
+    beam.file.reset();
+  }
+
+  /** @brief hand the block being filled to writer threads, if it holds samples */
+  void submit_block(beam_type& beam) {
+    block_type* block = beam.current;
+    beam.current = nullptr;
+    if (block == nullptr) {
+      return;
+    }
+    if (block->nsamples == 0) {
+      std::lock_guard lock{beam.free_mutex};
+      block->file.reset();
+      beam.free_blocks.push_back(block);
+      return;
+    }
+    write_queue.push(block);
+  }
+
+  /** @brief take a free block for samples starting at `sample_index` of current file, false if none is free */
+  bool take_block(beam_type& beam, counter_type sample_index) {
+    {
+      std::lock_guard lock{beam.free_mutex};
+      if (beam.free_blocks.empty()) {
+        return false;
+      }
+      beam.current = beam.free_blocks.back();
+      beam.free_blocks.pop_back();
+    }
+    block_type& block = *beam.current;
+    block.nsamples = 0;
+    block.file = beam.file;
+    block.first_sample = sample_index;
+    block.offset = beam.header_size + sample_index * written_sample_size;
+    return true;
+  }
+
+  /**
+   * @brief convert a sample in packet to sigproc layout
+   *
+   * input data may be interlaced:
+   *         if(1)ch(1)  if(2)ch(1)  if(1)ch(2)  if(2)ch(2)  ...  if(1)ch(nchans)  if(2)ch(nchans)
+   * choices:
+   *  1) one needs summed/averaged results, i.e.
+   *          ((if(1)+if(2))/2)ch(1)  ((if(1)+if(2))/2)ch(2)  ...  ((if(1)+if(2))/2)ch(nchans)
+   *  2) one needs two polarizations, however sigproc .fil requires:
+   *          if(1)ch(1)  if(1)ch(2)  ...  if(1)ch(nchans)  if(2)ch(1)  if(2)ch(2)  ...  if(2)ch(nchans)
+   *  deinterlace is therefore required.
+   *  3) do not do extra process
+   * moreover, `dedisperse`'s algorithm requires foff < 0, but input often has foff > 0, so need to reverse channels.
+   */
+  void convert_sample(const uint8_t* __restrict in,
+                      uint8_t* __restrict out) const {
+    const size_t n = written_sample_size;
+    if (config.sum_ifs) {
+      // average every two bytes
+      if (config.reverse_channel) {
+        for (size_t i = 0; i < n; i++) {
+          out[n - 1 - i] = in[2 * i] / 2 + in[2 * i + 1] / 2;
+        }
+      } else {
+        for (size_t i = 0; i < n; i++) {
+          out[i] = in[2 * i] / 2 + in[2 * i + 1] / 2;
+        }
+      }
+    } else if (config.nifs == 2 && config.deinterlace_channel) {
+      const size_t half = n / 2;
+      if (config.reverse_channel) {
+        for (size_t i = 0; i < half; i++) {
+          out[half - 1 - i] = in[2 * i];
+          out[n - 1 - i] = in[2 * i + 1];
+        }
+      } else {
+        for (size_t i = 0; i < half; i++) {
+          out[i] = in[2 * i];
+          out[half + i] = in[2 * i + 1];
+        }
+      }
+    } else {
+      if (config.reverse_channel) {
+        for (size_t i = 0; i < n; i++) {
+          out[n - 1 - i] = in[i];
+        }
+      } else {
+        std::memcpy(out, in, n);
+      }
+    }
+  }
+
+  /** @brief put one packet of the beam into its current block, called with beam.mutex held */
+  void handle_packet(beam_type& beam, const uint8_t* packet, size_t length) {
+    beam.stat.received_packets++;
+    if (length != counter_size + received_sample_size) {
+      beam.stat.bad_length_packets++;
+      return;
+    }
+
+    // data structure:
+    //     xxxxxxxxxxxxxx......xxxxxx  <-- one sample
+    //     |------||-----......-----|
+    //      counter `nchan` channels
+    //      8 bytes  nchan * nbits/8 bytes
+    counter_type counter = 0;
+    for (size_t i = 0; i < counter_size; i++) {
+      counter |= static_cast<counter_type>(packet[i]) << (8 * i);
+    }
+    bool restarted = false;
+    if (beam.last_counter_set) {
+      if (counter <= beam.last_counter) {
+        // a small step back is reordering; a large one is sender restarted
+        // with counter reset, then later packets all continue from here
+        if (beam.last_counter - counter < config.restart_threshold) {
+          beam.stat.out_of_order_packets++;
+          return;
+        }
+        beam.stat.restarts++;
+        restarted = true;
+      } else {
+        beam.stat.lost_packets += counter - beam.last_counter - 1;
+      }
+    }
+
+    // counter is used across files, a file holds samples of counter [file_first_counter, file_first_counter + nsamples)
+    if (!beam.file || restarted) {
+      roll_file(beam, counter, mjd_now());
+    } else if (counter - beam.file_first_counter >= config.nsamples) {
+      counter_type elapsed = counter - beam.file_first_counter;
+      if (elapsed < 2 * config.nsamples) {
+        // next file starts right after this one, tstart follows counter, lost tail of this one is 0
+        beam.file->length =
+            beam.header_size + config.nsamples * written_sample_size;
+        counter_type first_counter = beam.file_first_counter + config.nsamples;
+        roll_file(beam, first_counter,
+                  beam.file_tstart + config.nsamples * config.tsamp / 86400);
+      } else {
+        // long gap, e.g. sender restarted
+        roll_file(beam, counter, mjd_now());
+      }
+    }
+    beam.last_counter = counter;
+    beam.last_counter_set = true;
+    counter_type sample_index = counter - beam.file_first_counter;
+    beam.file->length = std::max<off_t>(
+        beam.file->length,
+        beam.header_size + (sample_index + 1) * written_sample_size);
+
+    // lost samples are filled with 0, within a block by memset, otherwise by the hole left in file
+    block_type* block = beam.current;
+    if (block != nullptr) {
+      counter_type block_end = block->first_sample + block->nsamples;
+      if (sample_index >= block->first_sample + config.block_nsamples) {
+        submit_block(beam);
+      } else if (sample_index > block_end) {
+        size_t gap = sample_index - block_end;
+        std::memset(block->data.data() + block->nsamples * written_sample_size,
+                    0, gap * written_sample_size);
+        block->nsamples += gap;
+      }
+    }
+    if (beam.current == nullptr && !take_block(beam, sample_index)) {
+      beam.stat.dropped_packets++;
+      return;
+    }
+
+    block = beam.current;
+    convert_sample(packet + counter_size,
+                   reinterpret_cast<uint8_t*>(block->data.data()) +
+                       block->nsamples * written_sample_size);
+    block->nsamples++;
+    if (block->nsamples == config.block_nsamples) {
+      submit_block(beam);
+    }
+  }
+
+  /**
+   * @brief a file of the beam can't be opened or written (e.g. disk full), so the packet is lost.
+   *        next packet tries a new file and other beams go on; only the first error of a beam is printed, later ones are counted
+   */
+  void file_error(beam_type& beam, const std::exception& e) {
+    if (beam.stat.file_errors++ == 0) {
+      std::cerr << "[receiver] error: beam " << beam.ibeam << ": " << e.what()
+                << ", further file errors of this beam are only counted"
+                << std::endl;
+    }
+    submit_block(beam);
+    beam.file.reset();
+    beam.last_counter_set = false;
+  }
+
+  /** @brief receive thread: take a readable beam, drain it, re-arm it */
+  void receive_loop() {
+    const size_t batch = config.recv_batch, packet_size = config.buffer_size;
+    // bound time spent on one beam so that others don't starve
+    constexpr size_t max_batches_per_wakeup = 16;
+    std::vector<uint8_t> buffer(batch * packet_size);
+    std::vector<iovec> iovecs(batch);
+    std::vector<mmsghdr> messages(batch);
+    for (size_t i = 0; i < batch; i++) {
+      iovecs[i].iov_base = buffer.data() + i * packet_size;
+      iovecs[i].iov_len = packet_size;
+      messages[i].msg_hdr = msghdr{};
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    constexpr int max_events = 16;
+    epoll_event events[max_events];
+
+    while (global::running) {
+      int count = epoll_wait(epoll_fd, events, max_events, 100);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error(std::string{"epoll_wait: "} +
+                                 std::strerror(errno));
+      }
+      for (int e = 0; e < count; e++) {
+        beam_type& beam = *static_cast<beam_type*>(events[e].data.ptr);
+        {
+          std::lock_guard lock{beam.mutex};
+          for (size_t b = 0; b < max_batches_per_wakeup; b++) {
+            int received = recvmmsg(beam.socket_fd, messages.data(), batch,
+                                    MSG_DONTWAIT, nullptr);
+            if (received <= 0) {
+              break;
+            }
+            for (int i = 0; i < received; i++) {
+              try {
+                handle_packet(beam, buffer.data() + i * packet_size,
+                              messages[i].msg_len);
+              } catch (const std::exception& e) {
+                file_error(beam, e);
+              }
+            }
+            if (static_cast<size_t>(received) < batch) {
+              break;
+            }
+          }
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = &beam;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, beam.socket_fd, &event) != 0) {
+          // not re-armed, so no thread will take this beam again
+          std::cerr << "[receiver] error: beam " << beam.ibeam
+                    << " stops receiving, epoll_ctl: " << std::strerror(errno)
+                    << std::endl;
+        }
+      }
+    }
+  }
+
+  /** @brief writer thread: write full blocks at their offsets, then give them back to their beams */
+  void write_loop() {
+    while (block_type* block = write_queue.pop()) {
+      size_t length = block->nsamples * written_sample_size;
+      ssize_t written =
+          pwrite(block->file->fd, block->data.data(), length, block->offset);
+      if (written != static_cast<ssize_t>(length)) {
+        std::cerr << "[receiver] warning: cannot write " << block->file->path
+                  << ": " << std::strerror(errno) << std::endl;
+      } else {
+        block->beam->stat.written_bytes += length;
+      }
+      beam_type& beam = *block->beam;
+      std::lock_guard lock{beam.free_mutex};
+      block->file.reset();
+      beam.free_blocks.push_back(block);
+    }
+  }
+
+  void print_stat(double seconds) {
+    std::cout << "[receiver] " << std::fixed << std::setprecision(1)
+              << seconds << " s" << std::endl;
+    for (const auto& beam : beams) {
+      const beam_stat& stat = beam->stat;
+      uint64_t received = stat.received_packets, lost = stat.lost_packets;
+      std::cout << "    beam " << std::setw(2) << beam->ibeam << " "
+                << beam->address << ":" << beam->port
+                << "  received = " << received << "  lost = " << lost << " ("
+                << std::setprecision(4)
+                << (received + lost ? 100.0 * lost / (received + lost) : 0.0)
+                << "%)"
+                << "  dropped = " << stat.dropped_packets
+                << "  bad_length = " << stat.bad_length_packets
+                << "  out_of_order = " << stat.out_of_order_packets
+                << "  written = " << std::setprecision(1)
+                << stat.written_bytes / 1e6 << " MB"
+                << "  files = " << stat.files
+                << "  restarts = " << stat.restarts
+                << "  file_errors = " << stat.file_errors << std::endl;
+    }
+  }
+
+  void run() {
+    size_t memory = beams.size() * config.blocks_per_beam *
+                        config.block_nsamples * written_sample_size +
+                    config.recv_threads * config.recv_batch * config.buffer_size;
+    std::cout << "[receiver] " << beams.size() << " beams, "
+              << config.recv_threads << " receive threads, "
+              << config.write_threads << " write threads, "
+              << memory / 1e6 << " MB of buffers" << std::endl;
+
+    std::vector<std::thread> receive_threads, write_threads;
+    for (size_t i = 0; i < config.write_threads; i++) {
+      write_threads.emplace_back([this] { write_loop(); });
+    }
+    for (size_t i = 0; i < config.recv_threads; i++) {
+      receive_threads.emplace_back([this] { receive_loop(); });
+    }
+
+    auto start = std::chrono::steady_clock::now(), last_stat = start;
+    while (global::running) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_stat >= std::chrono::seconds(config.stat_interval)) {
+        print_stat(std::chrono::duration<double>(now - start).count());
+        last_stat = now;
+      }
+    }
+
+    for (auto& thread : receive_threads) {
+      thread.join();
+    }
+    for (auto& beam : beams) {
+      finish_file(*beam);
+    }
+    write_queue.close();
+    for (auto& thread : write_threads) {
+      thread.join();
+    }
+    print_stat(std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count());
+  }
+};
+
+inline int main() {
+  try {
+    config_type config = read_config();
+    receiver receiver{config};
+    std::signal(SIGINT, [](int) { global::running = false; });
+    std::signal(SIGTERM, [](int) { global::running = false; });
+    receiver.run();
+  } catch (const boost::python::error_already_set&) {
+    PyErr_Print();
+    return EXIT_FAILURE;
+  } catch (const std::exception& e) {
+    std::cerr << "[main] " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
 
 }  // namespace udp_receiver
 }  // namespace prototype
@@ -0,0 +1,122 @@
+/*******************************************************************************
+ * Copyright (c) 2022-2023 fxzjshm
+ * This software is licensed under Mulan PubL v2.
+ * You can use this software according to the terms and conditions of the Mulan PubL v2.
+ * You may obtain a copy of Mulan PubL v2 at:
+ *          http://license.coscl.org.cn/MulanPubL-2.0
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+ * EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+ * MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the Mulan PubL v2 for more details.
+ ******************************************************************************/
+
+// writer of chunked, compressed filterbank container (.fbz),
+// same layout as from_baseband/source/fbz.hpp, which also has the reader and `fbz2fil` converter:
+//     header:  "FBZ1", u32 version, u32 element_size, u32 codec, u64 sample_bytes, u64 chunk_nsamps,
+//              u64 sigproc_header_size, sigproc header
+//     chunks:  bit-shuffled then zstd compressed
+//     index:   u64 chunk_count, then (u64 offset, u64 compressed_size, u64 nsamps) of each chunk
+//     footer:  u64 index_offset, "FBZI"
+// all integers are little endian.
+
+use std;
+use std::io::Write;
+use zstd;
+
+const version: u32 = 1;
+const codec_zstd: u32 = 1;
+
+/// transpose 8x8 bit matrix, byte i bit j <-> byte j bit i
+fn transpose_8x8(mut x: u64) -> u64 {
+  let mut t: u64;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AA;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCC;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0;
+  x = x ^ t ^ (t << 28);
+  x
+}
+
+/// bit-shuffle elements of `element_size` bytes into `8 * element_size` bit planes,
+/// elements that don't fill a group of 8 are copied as is
+fn bitshuffle(input: &[u8], element_size: usize) -> Vec<u8> {
+  let count = input.len() / element_size;
+  let groups = count / 8;
+  let mut output = vec![0 as u8; input.len()];
+  for g in 0..groups {
+    for b in 0..element_size {
+      let mut x: u64 = 0;
+      for i in 0..8 {
+        x |= (input[(8 * g + i) * element_size + b] as u64) << (8 * i);
+      }
+      x = transpose_8x8(x);
+      for k in 0..8 {
+        output[(8 * b + k) * groups + g] = (x >> (8 * k)) as u8;
+      }
+    }
+  }
+  let tail = 8 * groups * element_size;
+  output[tail..].copy_from_slice(&input[tail..]);
+  output
+}
+
+/// write `content` (samples of `sample_bytes` bytes) to `file` as .fbz,
+/// chunks of `chunk_nsamps` samples are compressed by `thread_count` threads at a time
+pub fn write(
+  file: &mut std::fs::File,
+  sigproc_header: &[u8],
+  content: &[u8],
+  element_size: usize,
+  sample_bytes: usize,
+  chunk_nsamps: usize,
+  level: i32,
+  thread_count: usize,
+) -> std::io::Result<()> {
+  let mut out = std::io::BufWriter::new(file);
+  out.write_all(b"FBZ1")?;
+  out.write_all(&version.to_le_bytes())?;
+  out.write_all(&(element_size as u32).to_le_bytes())?;
+  out.write_all(&codec_zstd.to_le_bytes())?;
+  out.write_all(&(sample_bytes as u64).to_le_bytes())?;
+  out.write_all(&(chunk_nsamps as u64).to_le_bytes())?;
+  out.write_all(&(sigproc_header.len() as u64).to_le_bytes())?;
+  out.write_all(sigproc_header)?;
+  let mut offset = (4 + 3 * 4 + 3 * 8 + sigproc_header.len()) as u64;
+
+  let chunks: Vec<&[u8]> = content.chunks(chunk_nsamps * sample_bytes).collect();
+  let mut index: Vec<(u64, u64, u64)> = Vec::with_capacity(chunks.len());
+  for group in chunks.chunks(std::cmp::max(thread_count, 1)) {
+    // errors of compression are returned to caller, instead of panicking receive threads
+    let compressed: std::io::Result<Vec<Vec<u8>>> = std::thread::scope(|scope| {
+      let handles: Vec<_> = group
+        .iter()
+        .map(|chunk| scope.spawn(move || zstd::bulk::compress(&bitshuffle(chunk, element_size), level)))
+        .collect();
+      handles
+        .into_iter()
+        .map(|handle| {
+          handle
+            .join()
+            .unwrap_or_else(|_| Err(std::io::Error::new(std::io::ErrorKind::Other, "compression thread panicked")))
+        })
+        .collect()
+    });
+    let compressed = compressed?;
+    for (chunk, data) in group.iter().zip(compressed.iter()) {
+      out.write_all(data)?;
+      index.push((offset, data.len() as u64, (chunk.len() / sample_bytes) as u64));
+      offset += data.len() as u64;
+    }
+  }
+
+  out.write_all(&(index.len() as u64).to_le_bytes())?;
+  for (chunk_offset, compressed_size, nsamps) in index {
+    out.write_all(&chunk_offset.to_le_bytes())?;
+    out.write_all(&compressed_size.to_le_bytes())?;
+    out.write_all(&nsamps.to_le_bytes())?;
+  }
+  out.write_all(&offset.to_le_bytes())?;
+  out.write_all(b"FBZI")?;
+  out.flush()
+}
@@ -14,6 +14,8 @@
 #![allow(unused_parens)]
 #![allow(non_upper_case_globals)]
 
+mod fbz;
+
 use chrono;
 use pyo3;
 use pyo3::prelude::*;
@@ -72,6 +74,10 @@ fn main() {
     .unwrap();
   let reverse_channel: bool = srtb_config.getattr("reverse_channel").unwrap().extract().unwrap();
   let deinterlace_channel: bool = srtb_config.getattr("deinterlace_channel").unwrap().extract().unwrap();
+  let compress_output: bool = srtb_config.getattr("compress_output").unwrap().extract().unwrap();
+  let compress_chunk_nsamps: usize = srtb_config.getattr("compress_chunk_nsamps").unwrap().extract().unwrap();
+  let compress_level: i32 = srtb_config.getattr("compress_level").unwrap().extract().unwrap();
+  let compress_threads: usize = srtb_config.getattr("compress_threads").unwrap().extract().unwrap();
   const udp_packet_max_size: usize = 65536;
   let mut packet_buffer = [0 as u8; udp_packet_max_size];
   //let mut output_buffer = [0 as u8; udp_packet_max_size];
@@ -104,10 +110,15 @@ fn main() {
     let tstart = mjd;
 
     // open file handle
-    let file_name = format!("{}_{:.8}.fil", file_name_prefix, mjd);
+    let file_name = format!(
+      "{}_{:.8}.{}",
+      file_name_prefix,
+      mjd,
+      if (compress_output) { "fbz" } else { "fil" }
+    );
     let file_path = format!("{}{}", data_location, file_name);
     println!("[main] receiving to {}", file_path);
-    let mut file = std::fs::File::create(file_path).unwrap();
+    let mut file = std::fs::File::create(&file_path).unwrap();
 
     // filterbank
     let mut filterbank: sigproc_filterbank::write::WriteFilterbank<u8> =
@@ -286,10 +297,25 @@ fn main() {
     }
 
     thread_pool.execute(move || {
-      file.write(&file_header).unwrap();
-      file
-        .write(&file_content[0..nsamples as usize * expected_written_data_length])
-        .unwrap();
+      let data = &file_content[0..nsamples as usize * expected_written_data_length];
+      if (compress_output) {
+        // a failed file is reported, later files are still written
+        if let Err(e) = fbz::write(
+          &mut file,
+          &file_header,
+          data,
+          nbits / 8,
+          expected_written_data_length,
+          compress_chunk_nsamps,
+          compress_level,
+          compress_threads,
+        ) {
+          eprintln!("[main] cannot write {}: {}", file_path, e);
+        }
+      } else {
+        file.write(&file_header).unwrap();
+        file.write(data).unwrap();
+      }
     });
 
     //break;
@@ -43,6 +43,12 @@ MCAST_GRP = '10.0.1.2'
 MCAST_PORT = 12001
 BUFFER_SIZE = 10240
 
+# compressed output (.fbz), bit-shuffled & zstd compressed chunks with an index, `fbz2fil` in from_baseband converts it back to .fil
+compress_output = False
+compress_chunk_nsamps = 4096  # samples per chunk
+compress_level = 1  # zstd level
+compress_threads = 4  # threads used to compress a file
+
 # misc
 # it is said that in formal observe the udp pack counter (first 8 bytes of a packet, in `uint64`` or `unsigned long long`) should start with 0
 start_from_counter_zero = False